@@ -0,0 +1,324 @@
+//
+// Created by jonathan on 10/17/26.
+//
+#include "gtest/gtest.h"
+#include "compiler.hpp"
+
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <system_error>
+#include <thread>
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+
+namespace {
+
+/// TempDir - A directory of the current test's own under the system's
+/// temporary directory, removed with everything in it when the test ends,
+/// so that concurrent runs of the suite never share files.
+class TempDir {
+    std::filesystem::path path;
+public:
+    TempDir() {
+        const auto* test = testing::UnitTest::GetInstance()->current_test_info();
+        llvm::SmallString<128> unique;
+        if (const auto error = llvm::sys::fs::createUniqueDirectory(std::string("ellis-") + test->name(), unique))
+            throw std::system_error(error, "cannot create a temporary directory");
+        path = unique.str().str();
+    }
+    TempDir(const TempDir&) = delete;
+    TempDir& operator=(const TempDir&) = delete;
+    ~TempDir() {
+        std::error_code ignored;
+        std::filesystem::remove_all(path, ignored);
+    }
+
+    std::filesystem::path operator/(const std::string& name) const { return path / name; }
+
+    /// Writes `contents` to the file `name` in the directory; returns its path.
+    std::string write(const std::string& name, const std::string& contents) const {
+        const auto file = path / name;
+        std::ofstream(file) << contents;
+        return file.string();
+    }
+};
+
+} // namespace
+
+TEST(CompilerTestSuite, ParallelCompileLinksFiles) {
+    const TempDir dir;
+    const auto main = dir.write("main.el", "let main x =\n  return 1 + twice x;\nend");
+    const auto lib = dir.write("lib.el", "let twice x =\n  return x * 2;\nend");
+    auto c = Compiler(false);
+    c.setJobs(2);
+    EXPECT_EQ(c.compile({main, lib}), 0);
+
+    const auto* twice = c.getModule().getFunction("twice");
+    ASSERT_NE(twice, nullptr);
+    EXPECT_FALSE(twice->isDeclaration());
+    ASSERT_NE(c.getModule().getFunction("main"), nullptr);
+    EXPECT_EQ(c.getModule().getFunction("twice1"), nullptr);
+    // The linked functions stay declared for code generated afterwards, also
+    // once the first evaluation has moved them into the JIT.
+    EXPECT_EQ(c.evaluate("twice 4;"), 8.0);
+    EXPECT_EQ(c.evaluate("1 + twice 5;"), 11.0);
+}
+
+TEST(CompilerTestSuite, ParallelCompileRejectsDuplicateDefinitions) {
+    const TempDir dir;
+    const auto a = dir.write("dup_a.el", "let f x =\n  return x;\nend");
+    const auto b = dir.write("dup_b.el", "let f y =\n  return y;\nend");
+    auto c = Compiler(false);
+    c.setJobs(2);
+    EXPECT_THROW(c.compile({a, b}), CodeGenerationException);
+}
+
+TEST(CompilerTestSuite, OptLevelNames) {
+    EXPECT_EQ(opt_level("0"), OptimizationLevel::O0);
+    EXPECT_EQ(opt_level("3"), OptimizationLevel::O3);
+    EXPECT_EQ(opt_level("s"), OptimizationLevel::Os);
+    EXPECT_EQ(opt_level("4"), std::nullopt);
+    EXPECT_EQ(codegen_opt_level(OptimizationLevel::O0), CodeGenOpt::None);
+}
+
+namespace {
+
+// Counts the instructions of `name` after compiling `path` at `level`.
+std::size_t instruction_count(const std::string& path, const std::string& name, const OptimizationLevel level) {
+    auto c = Compiler(false, level);
+    c.setJobs(1);
+    c.compile({path});
+    return c.getModule().getFunction(name)->getInstructionCount();
+}
+
+} // namespace
+
+TEST(CompilerTestSuite, OptimizationRunsOnCompiledModule) {
+    const TempDir dir;
+    const auto path = dir.write("opt.el", "let f x =\n  let y = 2 * 3;\n  return x + y;\nend");
+    // Unoptimized: argument and local slots, their stores and loads.
+    EXPECT_GT(instruction_count(path, "f", OptimizationLevel::O0), 2);
+    // Optimized: the fadd of a folded constant, and the ret.
+    EXPECT_EQ(instruction_count(path, "f", OptimizationLevel::O2), 2);
+}
+
+TEST(CompilerTestSuite, TimingsAndRemarks) {
+    const TempDir dir;
+    const auto path = dir.write("remarks.el", "let sq x =\n  return x * x;\nend\nlet f x =\n  return 1 + sq x;\nend");
+    const auto yaml = (dir / "remarks.yaml").string();
+    auto c = Compiler(false, OptimizationLevel::O2);
+    c.setJobs(1);
+    c.timePasses();
+    c.writeRemarks(yaml);
+    testing::internal::CaptureStderr();
+    c.compile({path});
+    const auto report = testing::internal::GetCapturedStderr();
+    EXPECT_NE(report.find("InlinerPass"), std::string::npos) << report;
+
+    std::ifstream in(yaml);
+    const std::string remarks((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    EXPECT_NE(remarks.find("--- !Passed\nPass:            inline\nName:            Inlined\nFunction:        f"),
+              std::string::npos) << remarks;
+}
+
+TEST(CompilerTestSuite, RemarksFileMustOpen) {
+    auto c = Compiler(false);
+    EXPECT_THROW(c.writeRemarks("/nonexistent/dir/remarks.yaml"), CodeGenerationException);
+}
+
+TEST(CompilerTestSuite, DefinitionsOutliveTheirExpression) {
+    auto c = Compiler(false);
+    EXPECT_EQ(c.evaluate("let twice x =\n  return x * 2;\nend\ntwice 4;"), 8.0);
+    EXPECT_EQ(c.evaluate("1 + twice 5;"), 11.0);
+}
+
+TEST(CompilerTestSuite, HotFunctionsTierUp) {
+    auto c = Compiler(false);
+    TieringOptions tiering;
+    tiering.threshold = 3;
+    tiering.log = nullptr;
+    c.enableTiering(tiering);
+
+    EXPECT_EQ(c.evaluate("let sq x =\n  return x * x;\nend\nsq 2;"), 4.0);
+    EXPECT_EQ(c.waitForTierUps(), 0u);
+    EXPECT_EQ(c.evaluate("sq 3;\nsq 4;"), 16.0);
+    EXPECT_EQ(c.waitForTierUps(), 1u);
+    // Now through the stub to the optimized body.
+    EXPECT_EQ(c.evaluate("sq 5;"), 25.0);
+    EXPECT_EQ(c.waitForTierUps(), 1u);
+}
+
+TEST(CompilerTestSuite, TierUpsReportRemarks) {
+    const TempDir dir;
+    const auto yaml = (dir / "remarks.yaml").string();
+    auto c = Compiler(false);
+    c.writeRemarks(yaml);
+    TieringOptions tiering;
+    tiering.threshold = 2;
+    tiering.log = nullptr;
+    c.enableTiering(tiering);
+
+    // A hot function is optimized on its own, so the inliner reports the
+    // call into its module's other function, now only declared.
+    EXPECT_EQ(c.evaluate("let inc x =\n  return x + 1;\nend\nlet f x =\n  return 2 * inc x;\nend\nf 1;\nf 2;"),
+              6.0);
+    EXPECT_EQ(c.waitForTierUps(), 2u);
+    std::ifstream in(yaml);
+    const std::string remarks((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    EXPECT_NE(remarks.find("Function:        'f$tier1'"), std::string::npos) << remarks;
+}
+
+TEST(CompilerTestSuite, LazyCompilationSkipsUncalledFunctions) {
+    const std::string source = "let a x =\n  return x + 1;\nend\n"
+                               "let b x =\n  return x * 2;\nend\n"
+                               "let c x =\n  return x - 3;\nend\n"
+                               "b 4;";
+    // At -O0 nothing is inlined into __anon_expr, so calling b needs b's module.
+    auto eager = Compiler(false, OptimizationLevel::O0);
+    EXPECT_EQ(eager.evaluate(source), 8.0);
+    EXPECT_EQ(eager.compiledFunctions(), 4u);
+
+    auto lazy = Compiler(false, OptimizationLevel::O0);
+    lazy.enableLazyCompilation();
+    EXPECT_EQ(lazy.evaluate(source), 8.0);
+    // Only b and __anon_expr were reached.
+    EXPECT_EQ(lazy.compiledFunctions(), 2u);
+    EXPECT_EQ(lazy.evaluate("a 1;"), 2.0);
+    EXPECT_EQ(lazy.compiledFunctions(), 4u);
+}
+
+TEST(CompilerTestSuite, ConcurrentEvaluation) {
+    auto c = Compiler(false, OptimizationLevel::O1, 4);
+    c.enableLazyCompilation();
+    EXPECT_EQ(c.evaluate("let sq x =\n  return x * x;\nend\nsq 1;"), 1.0);
+
+    // Each thread defines a function of its own and calls it and sq.
+    std::vector<double> results(8);
+    std::vector<std::thread> threads;
+    for (std::size_t i = 0; i < results.size(); i++) {
+        threads.emplace_back([&, i] {
+            const auto n = std::to_string(i);
+            results[i] = c.evaluate("let f" + n + " x =\n  return x + " + n + ";\nend\n1 + f" + n + " (sq 3);");
+        });
+    }
+    for (auto& thread : threads)
+        thread.join();
+    for (std::size_t i = 0; i < results.size(); i++)
+        EXPECT_EQ(results[i], 10.0 + i);
+}
+
+TEST(CompilerTestSuite, ObjectCacheSkipsCodegenOnRepeatRuns) {
+    const TempDir dir;
+    ObjectCacheOptions options;
+    options.path = (dir / "cache").string();
+    const std::string source = "let sq x =\n  return x * x;\nend\nsq 7;";
+
+    // sq is inlined, so only the expression's module is ever compiled.
+    {
+        auto first = Compiler(false);
+        first.enableObjectCache(options);
+        EXPECT_EQ(first.evaluate(source), 49.0);
+        EXPECT_EQ(first.getObjectCache().hits(), 0u);
+        EXPECT_EQ(first.getObjectCache().stores(), 1u);
+    }
+    {
+        auto second = Compiler(false);
+        second.enableObjectCache(options);
+        EXPECT_EQ(second.evaluate(source), 49.0);
+        EXPECT_EQ(second.getObjectCache().hits(), 1u);
+        EXPECT_EQ(second.getObjectCache().stores(), 0u);
+        // A different program, or the same at another level, is compiled:
+        // here sq, which the new expression calls, and the expression.
+        EXPECT_EQ(second.evaluate("sq 8;"), 64.0);
+        EXPECT_EQ(second.getObjectCache().stores(), 2u);
+    }
+    {
+        auto other = Compiler(false, OptimizationLevel::O0);
+        other.enableObjectCache(options);
+        EXPECT_EQ(other.evaluate(source), 49.0);
+        EXPECT_EQ(other.getObjectCache().hits(), 0u);
+    }
+
+    // Pruned down to its size limit when a run that stored objects ends.
+    options.max_bytes = 1;
+    {
+        auto pruned = Compiler(false);
+        pruned.enableObjectCache(options);
+        EXPECT_EQ(pruned.evaluate("let cube x =\n  return x * x * x;\nend\ncube 3;"), 27.0);
+    }
+    std::size_t objects = 0;
+    for (const auto& file : std::filesystem::directory_iterator(options.path))
+        objects += file.path().filename().string().rfind("llvmcache-", 0) == 0;
+    EXPECT_EQ(objects, 0u);
+}
+
+TEST(CompilerTestSuite, ObjectCacheKeepsBothTiers) {
+    const TempDir dir;
+    ObjectCacheOptions options;
+    options.path = (dir / "cache").string();
+    TieringOptions tiering;
+    tiering.threshold = 2;
+    tiering.log = nullptr;
+    const std::string source = "let sq x =\n  return x * x;\nend\nsq 2;\nsq 3;";
+
+    unsigned baseline = 0;
+    {
+        auto first = Compiler(false);
+        first.enableObjectCache(options);
+        first.enableTiering(tiering);
+        EXPECT_EQ(first.evaluate(source), 9.0);
+        EXPECT_EQ(first.waitForTierUps(), 1u);
+        EXPECT_EQ(first.evaluate("sq 4;"), 16.0);
+        const auto* tiers = first.getTiers();
+        ASSERT_NE(tiers, nullptr);
+        baseline = tiers->getBaselineCache().stores();
+        EXPECT_GT(baseline, 0u);
+        EXPECT_EQ(tiers->getBaselineCache().hits(), 0u);
+        EXPECT_EQ(tiers->getOptimizedCache().stores(), 1u);
+    }
+    // The same run again, with the cache enabled after tiering this time,
+    // compiles nothing: the counters and stubs are found by relocation.
+    {
+        auto second = Compiler(false);
+        second.enableTiering(tiering);
+        second.enableObjectCache(options);
+        EXPECT_EQ(second.evaluate(source), 9.0);
+        EXPECT_EQ(second.waitForTierUps(), 1u);
+        EXPECT_EQ(second.evaluate("sq 4;"), 16.0);
+        const auto* tiers = second.getTiers();
+        EXPECT_EQ(tiers->getBaselineCache().hits(), baseline);
+        EXPECT_EQ(tiers->getBaselineCache().stores(), 0u);
+        EXPECT_EQ(tiers->getOptimizedCache().hits(), 1u);
+        EXPECT_EQ(tiers->getOptimizedCache().stores(), 0u);
+        EXPECT_EQ(second.getObjectCache().stores(), 0u);
+    }
+}
+
+TEST(CompilerTestSuite, EmitsAndLinksAheadOfTime) {
+    const TempDir dir;
+    const auto source = dir.write("aot.el", "let twice x =\n  return x * 2;\nend\n"
+                                            "let main () =\n  return 1 + twice 20;\nend");
+    auto c = Compiler(false);
+    ASSERT_EQ(c.compile({source}), 0);
+
+    for (const auto* name : {"obj", "asm", "llvm-ir", "llvm-bc"}) {
+        const auto kind = emit_kind(name);
+        ASSERT_TRUE(kind.has_value()) << name;
+        const auto path = dir / (std::string("aot") + emit_extension(*kind));
+        c.emit(*kind, path.string());
+        EXPECT_GT(std::filesystem::file_size(path), 0u) << name;
+    }
+    EXPECT_FALSE(emit_kind("exe").has_value());
+    // The program's main is called from a C entry point.
+    ASSERT_NE(c.getModule().getFunction("__ellis_main"), nullptr);
+    EXPECT_TRUE(c.getModule().getFunction("main")->getReturnType()->isIntegerTy(32));
+
+    const auto executable = (dir / "aot").string();
+    c.link(executable);
+    const auto status = std::system(executable.c_str());
+    ASSERT_TRUE(WIFEXITED(status));
+    EXPECT_EQ(WEXITSTATUS(status), 41);
+    EXPECT_THROW(c.link((dir / "no_such_dir" / "aot").string()), CodeGenerationException);
+}
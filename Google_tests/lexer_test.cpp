@@ -3,6 +3,8 @@
 //
 #include "gtest/gtest.h"
 #include "lex.hpp"
+#include "lex_simd.hpp"
+#include "symbol.hpp"
 
 
 TEST(LexerTestSuite, SimpleLet) {
@@ -11,7 +13,7 @@ TEST(LexerTestSuite, SimpleLet) {
         TokenPair(tok_let, "let"),
         TokenPair(tok_identifier, "x"),
         TokenPair(tok_operator, "="),
-        TokenPair(tok_number, "1"),
+        TokenPair(tok_integer, "1"),
         TokenPair(tok_semicolon, ";")
     };
     EXPECT_EQ(lex(source, false), result);
@@ -25,7 +27,7 @@ TEST(LexerTestSuite, SimpleParen) {
             TokenPair(tok_operator, "*"),
             TokenPair(tok_identifier, "y"),
             TokenPair(tok_operator, "+"),
-            TokenPair (tok_number, "2"),
+            TokenPair (tok_integer, "2"),
             TokenPair (tok_rparen, ")")
     };
     EXPECT_EQ(lex(source, false), result);
@@ -36,8 +38,115 @@ TEST(LexerTestSuite, SimpleOperator) {
     const std::vector<TokenPair> result = {
             TokenPair(tok_identifier, "x"),
             TokenPair (tok_operator, "+="),
-            TokenPair (tok_number, "1")
+            TokenPair (tok_integer, "1")
     };
     EXPECT_EQ(lex(source, false), result);
 }
 
+
+TEST(LexerTestSuite, ScanViews) {
+    std::string source = "f \"a b\" # comment\n  x";
+    const auto tokens = scan(source);
+    ASSERT_EQ(tokens.size(), 3);
+    EXPECT_EQ(tokens[1].kind(), tok_string_literal);
+    EXPECT_EQ(tokens[1].offset, 3);
+    EXPECT_EQ(token_text(source, tokens[1]), "a b");
+    EXPECT_EQ(tokens[2].kind(), tok_identifier);
+    EXPECT_EQ(token_text(source, tokens[2]), "x");
+}
+
+TEST(LexerTestSuite, UnterminatedString) {
+    EXPECT_THROW(scan("print \"oops"), std::invalid_argument);
+}
+
+TEST(LexerTestSuite, InternedSymbols) {
+    const std::string source = "add x (add x 1)";
+    const auto tokens = scan(source);
+    ASSERT_EQ(tokens.size(), 7);
+    const auto symbol = [&](const std::size_t i) { return intern(token_text(source, tokens[i])); };
+    EXPECT_EQ(symbol(0), symbol(3));
+    EXPECT_EQ(symbol(1), symbol(4));
+    EXPECT_NE(symbol(0), symbol(1));
+    EXPECT_EQ(symbol_name(symbol(0)), "add");
+    EXPECT_NE(symbol(0), no_symbol);
+}
+
+TEST(LexerTestSuite, PackedTokens) {
+    const auto t = TokenView::make(tok_identifier, 123456, 70000);
+    EXPECT_EQ(sizeof(t), 8);
+    EXPECT_EQ(t.kind(), tok_identifier);
+    EXPECT_EQ(t.offset, 123456);
+    EXPECT_EQ(t.length(), 70000);
+    EXPECT_EQ(TokenView::make(tok_eof, 0, 0).kind(), tok_eof);
+}
+
+TEST(LexerTestSuite, LineColumn) {
+    const auto lexer = Lexer("let x = 1;\n\n  y;\n");
+    EXPECT_EQ(lexer.locate(4).line, 1);
+    EXPECT_EQ(lexer.locate(4).column, 5);
+    EXPECT_EQ(lexer.locate(14).line, 3);
+    EXPECT_EQ(lexer.locate(14).column, 3);
+    EXPECT_EQ(lexer.locate(11).line, 2);
+}
+
+TEST(LexerTestSuite, KeywordsAndPunctuation) {
+    const auto tokens = scan("return returns or end_x.");
+    ASSERT_EQ(tokens.size(), 5);
+    EXPECT_EQ(tokens[0].kind(), tok_return);
+    EXPECT_EQ(tokens[1].kind(), tok_identifier);
+    EXPECT_EQ(tokens[2].kind(), tok_log_op);
+    EXPECT_EQ(tokens[3].kind(), tok_identifier);
+    EXPECT_EQ(tokens[4].kind(), tok_period);
+    EXPECT_THROW(scan("x @ y"), std::invalid_argument);
+}
+
+TEST(LexerTestSuite, ScanKernelsAgree) {
+    std::string source;
+    for (int i = 0; i < 64; i++)
+        source += std::string(i % 37, ' ') + "name_" + std::string(i, 'x') + " 12.5" + std::string(i, '0') + "\n";
+
+    const auto previous = get_scan_isa();
+    set_scan_isa(ScanIsa::scalar);
+    const auto expected = lex(source, false);
+    for (const auto isa : {ScanIsa::sse2, ScanIsa::avx2}) {
+        if (set_scan_isa(isa) == isa) {
+            EXPECT_EQ(lex(source, false), expected) << scan_isa_name(isa);
+            EXPECT_EQ(skip_whitespace("\t\r\n\v\f      !", 0), 11);
+        }
+    }
+    set_scan_isa(previous);
+}
+
+TEST(LexerTestSuite, NumberLiterals) {
+    auto lexer = Lexer("42 1_000_000 0x7f_ff 0b1010 3.25 1e-3 6.022_140e23 1.x");
+    const std::int64_t integers[] = {42, 1000000, 0x7fff, 10};
+    for (const auto expected : integers) {
+        EXPECT_EQ(lexer.next().kind(), tok_integer);
+        EXPECT_EQ(lexer.literal().integer, expected);
+    }
+    const double floats[] = {3.25, 1e-3, 6.022140e23};
+    for (const auto expected : floats) {
+        EXPECT_EQ(lexer.next().kind(), tok_float);
+        EXPECT_DOUBLE_EQ(lexer.literal().floating, expected);
+    }
+    EXPECT_EQ(lexer.next().kind(), tok_integer);
+    EXPECT_EQ(lexer.next().kind(), tok_period);
+
+    EXPECT_THROW(scan("12abc"), std::invalid_argument);
+    EXPECT_THROW(scan("0x"), std::invalid_argument);
+    EXPECT_THROW(scan("99999999999999999999"), std::invalid_argument);
+}
+
+TEST(LexerTestSuite, OperatorsClassified) {
+    for (const std::string_view spelling : infix_operators) {
+        auto lexer = Lexer(spelling);
+        EXPECT_EQ(lexer.next().kind(), tok_operator) << spelling;
+        EXPECT_NE(lexer.op(), OperatorKind::none) << spelling;
+        EXPECT_EQ(operator_spelling(lexer.op()), spelling);
+    }
+    auto lexer = Lexer("+- =");
+    lexer.next();
+    EXPECT_EQ(lexer.op(), OperatorKind::none);
+    lexer.next();
+    EXPECT_EQ(lexer.op(), OperatorKind::assign);
+}
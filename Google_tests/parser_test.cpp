@@ -1,3 +1,288 @@
 //
 // Created by jonathan on 2/15/24.
 //
+#include "gtest/gtest.h"
+#include "lex.hpp"
+#include "parser.hpp"
+
+#include <sstream>
+#include <thread>
+
+
+TEST(ParserTestSuite, TokenStreamPeekPastEnd) {
+    auto lexer = Lexer("x");
+    auto stream = TokenStream(lexer);
+    EXPECT_EQ(stream.peek(1).kind(), tok_eof);
+    EXPECT_EQ(stream.text(), "x");
+    EXPECT_EQ(stream.advance().kind(), tok_identifier);
+    EXPECT_TRUE(stream.empty());
+    EXPECT_EQ(stream.advance().kind(), tok_eof);
+    EXPECT_THROW(stream.peek(2), std::logic_error);
+}
+
+TEST(ParserTestSuite, FunctionDefinition) {
+    ASTContext ctx;
+    const auto asts = parse("let f x y =\n  return x + y;\nend", ctx);
+    ASSERT_EQ(asts.size(), 1);
+    std::stringstream ss;
+    ss << AST(ctx, asts[0]);
+    EXPECT_EQ(ss.str(), "Function f( x y )\n\tReturn(+(Variable(x) , Variable(y)))\n");
+}
+
+TEST(ParserTestSuite, MissingTerminator) {
+    ASTContext ctx;
+    EXPECT_THROW(parse("f x", ctx), ParsingException);
+}
+
+TEST(ParserTestSuite, ErrorLocation) {
+    ASTContext ctx;
+    try {
+        parse("let f x =\n  return x;\nlet", ctx);
+        FAIL() << "expected a ParsingException";
+    } catch (const ParsingException& e) {
+        EXPECT_EQ(std::string(e.what()).rfind("3:4: ", 0), 0) << e.what();
+    }
+}
+
+TEST(ParserTestSuite, NodesLiveInContext) {
+    ASTContext ctx;
+    const auto asts = parse("let g a b c =\n  return h a \"s\" (b);\nend", ctx);
+    ASSERT_EQ(asts.size(), 1);
+    const auto fn = FunctionAST(ctx, asts[0]);
+    EXPECT_EQ(fn.kind(), NodeKind::Function);
+    EXPECT_EQ(fn.getProto().getArgs().size(), 3u);
+    ASSERT_EQ(fn.getBody().size(), 1u);
+    const auto call = fn.getBody()[0].as<ReturnAST>().getRetExpr();
+    ASSERT_EQ(call.kind(), NodeKind::Call);
+    EXPECT_EQ(call.as<CallExprAST>().getArgs()[1].as<StringExprAST>().getVal(), "s");
+}
+
+TEST(ParserTestSuite, ChildrenPrecedeParents) {
+    // Nodes are laid out bottom-up, so a front-to-back sweep sees every
+    // child before the node that uses it.
+    std::string source;
+    for (int i = 0; i < 100; i++)
+        source += "let f" + std::to_string(i) + " x =\n  let y = x * 2;\n  return y + f x;\nend\n";
+    ASTContext ctx;
+    const auto asts = parse(source, ctx);
+    ASSERT_EQ(asts.size(), 100u);
+    for (NodeId id = 0; id < ctx.size(); id++) {
+        switch (ctx.kind(id)) {
+            case NodeKind::Binary:
+                EXPECT_LT(ctx.operand(id, 1), id);
+                EXPECT_LT(ctx.operand(id, 2), id);
+                break;
+            case NodeKind::Function:
+                EXPECT_LT(ctx.operand(id, 0), id);
+                for (const auto child : ctx.items(ctx.operand(id, 1)))
+                    EXPECT_LT(child, id);
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+// Counts the nodes reachable from a root, returning the count by value.
+class NodeCounter : public ASTVisitor<NodeCounter, int> {
+    int visitAll(const NodeRange& nodes) {
+        int n = 0;
+        for (const auto node : nodes)
+            n += visit(node);
+        return n;
+    }
+public:
+    int Visit(UnitExprAST) { return 1; }
+    int Visit(NumberExprAST) { return 1; }
+    int Visit(StringExprAST) { return 1; }
+    int Visit(CharExprAST) { return 1; }
+    int Visit(VariableExprAST) { return 1; }
+    int Visit(const VariableDefAST ast) { return 1 + visit(ast.getValue()); }
+    int Visit(const BinaryExprAST ast) { return 1 + visit(ast.getLHS()) + visit(ast.getRHS()); }
+    int Visit(const CallExprAST ast) { return 1 + visitAll(ast.getArgs()); }
+    int Visit(PrototypeAST) { return 1; }
+    int Visit(const FunctionAST ast) { return 1 + visit(ast.getProto()) + visitAll(ast.getBody()); }
+    int Visit(const ReturnAST ast) { return 1 + (ast.hasRetExpr() ? visit(ast.getRetExpr()) : 0); }
+    int Visit(const IfAST ast) { return 1 + visit(ast.getCondition()) + visitAll(ast.getThen()) + visitAll(ast.getElse()); }
+};
+
+TEST(ParserTestSuite, StaticVisitor) {
+    ASTContext ctx;
+    const auto asts = parse("let f x =\n  let y = x * 2;\n  return g y 'c';\nend", ctx);
+    ASSERT_EQ(asts.size(), 1);
+    // Function, Prototype, VariableDef, *, x, 2, Return, Call, y, 'c'
+    EXPECT_EQ(NodeCounter().visit(AST(ctx, asts[0])), 10);
+    EXPECT_EQ(ctx.size(), 10u);
+}
+
+TEST(ParserTestSuite, OperatorPrecedence) {
+    ASTContext ctx;
+    const auto asts = parse("b - c * d ^ e ^ f < g;", ctx);
+    ASSERT_EQ(asts.size(), 1);
+    std::stringstream ss;
+    ss << AST(ctx, asts[0]);
+    EXPECT_EQ(ss.str(), "<(-(Variable(b) , *(Variable(c) , ^(Variable(d) , ^(Variable(e) , Variable(f))))) , Variable(g))");
+    EXPECT_EQ(AST(ctx, asts[0]).as<BinaryExprAST>().getOp(), OperatorKind::lt);
+}
+
+TEST(ParserTestSuite, DeepNesting) {
+    // Far deeper than the native stack would allow a recursive parser.
+    const int depth = 200000;
+    ASTContext ctx;
+    const auto asts = parse(std::string(depth, '(') + "x + 1" + std::string(depth, ')') + ";", ctx);
+    ASSERT_EQ(asts.size(), 1);
+    EXPECT_EQ(AST(ctx, asts[0]).as<BinaryExprAST>().getOp(), OperatorKind::add);
+    EXPECT_EQ(ctx.size(), 3u);
+
+    ctx.reset();
+    std::string chain = "x";
+    for (int i = 0; i < 5000; i++)
+        chain += i % 2 ? " * (y" : " + y";
+    chain += std::string(2500, ')') + ";";
+    EXPECT_EQ(parse(chain, ctx).size(), 1);
+    EXPECT_EQ(ctx.size(), 10001u);
+}
+
+TEST(ParserTestSuite, AllInfixOperators) {
+    for (const std::string_view op : infix_operators) {
+        ASTContext ctx;
+        const auto source = "a " + std::string(op) + " b " + std::string(op) + " c;";
+        const auto asts = parse(source, ctx);
+        ASSERT_EQ(asts.size(), 1) << op;
+        const auto root = AST(ctx, asts[0]).as<BinaryExprAST>();
+        EXPECT_EQ(root.getOpName(), op);
+        // Assignments group to the right, everything else but ^ to the left.
+        const auto& info = operator_info(root.getOp());
+        const auto nested = info.associativity == Associativity::right ? root.getRHS() : root.getLHS();
+        EXPECT_EQ(nested.kind(), NodeKind::Binary) << op;
+    }
+}
+
+TEST(ParserTestSuite, CallsInExpressions) {
+    ASTContext ctx;
+    const auto asts = parse("x += f (g 1) (y - 2 * h ());", ctx);
+    ASSERT_EQ(asts.size(), 1);
+    std::stringstream ss;
+    ss << AST(ctx, asts[0]);
+    EXPECT_EQ(ss.str(), "+=(Variable(x) , f( g( Number(1) ) -(Variable(y) , *(Number(2) , h( Unit() ))) ))");
+}
+
+TEST(ParserTestSuite, CallArgumentsAreAtoms) {
+    ASTContext ctx;
+    EXPECT_THROW(parse("f y - 2;", ctx), ParsingException);
+    EXPECT_THROW(parse("(1 + 2;", ctx), ParsingException);
+    EXPECT_THROW(parse("1 + ;", ctx), ParsingException);
+}
+
+std::string print_all(ASTContext& ctx, const std::vector<NodeId>& asts) {
+    std::stringstream ss;
+    for (const auto id : asts)
+        ss << AST(ctx, id) << "\n";
+    return ss.str();
+}
+
+TEST(ParserTestSuite, ParallelMatchesSerial) {
+    std::string source;
+    for (int i = 0; i < 3000; i++) {
+        const auto n = std::to_string(i);
+        source += "let f" + n + " x =\n  let y = x * " + n + ";\n  if y < 10 then\n    return y;\n  end\n  return g" + n + " y;\nend\n";
+        source += "let v" + n + " = \"s" + n + "\";\n";
+    }
+    ASSERT_GE(source.size(), parallel_parse_min_bytes);
+
+    ASTContext serial_ctx;
+    const auto serial = parse(source, serial_ctx, 1);
+    ASTContext parallel_ctx;
+    const auto parallel = parse(source, parallel_ctx, 4);
+    ASSERT_EQ(parallel.size(), 6000u);
+    EXPECT_EQ(parallel_ctx.size(), serial_ctx.size());
+    EXPECT_EQ(print_all(parallel_ctx, parallel), print_all(serial_ctx, serial));
+}
+
+TEST(ParserTestSuite, ParallelErrorLocation) {
+    std::string source;
+    for (int i = 0; i < 4000; i++)
+        source += "let f x =\n  return x;\nend\n";
+    source += "let 1\n";
+    for (int i = 0; i < 4000; i++)
+        source += "let f x =\n  return x;\nend\n";
+
+    ASTContext ctx;
+    try {
+        parse(source, ctx, 4);
+        FAIL() << "expected a ParsingException";
+    } catch (const ParsingException& e) {
+        EXPECT_EQ(std::string(e.what()).rfind("12001:5: ", 0), 0) << e.what();
+    }
+}
+
+// Drains a pipelined parse, printing each statement as it arrives.
+std::string print_pipelined(const std::string& source, const std::size_t depth = pipeline_depth) {
+    StatementQueue statements(depth);
+    std::thread parser([&] { parse_pipelined(source, statements); });
+    std::stringstream ss;
+    try {
+        while (auto statement = statements.pop())
+            ss << AST((*statement)->ctx, (*statement)->root) << "\n";
+    } catch (...) {
+        parser.join();
+        throw;
+    }
+    parser.join();
+    return ss.str();
+}
+
+TEST(ParserTestSuite, PipelinedMatchesSerial) {
+    std::string source;
+    for (int i = 0; i < 500; i++) {
+        const auto n = std::to_string(i);
+        source += "let f" + n + " x =\n  return x * " + n + " + g" + n + " (x - 1);\nend\n";
+        source += "let v" + n + " = 'c';\n";
+    }
+    ASTContext ctx;
+    const auto serial = parse(source, ctx, 1);
+    EXPECT_EQ(print_pipelined(source, 2), print_all(ctx, serial));
+}
+
+TEST(ParserTestSuite, PipelinedErrorsInSourceOrder) {
+    std::string source;
+    for (int i = 0; i < 2000; i++)
+        source += "x = " + std::to_string(i) + ";\n";
+    EXPECT_THROW(print_pipelined(source + "let 1\nx = $;\n"), ParsingException);
+    EXPECT_THROW(print_pipelined(source + "x = $;\nlet 1\n"), std::invalid_argument);
+}
+
+TEST(ParserTestSuite, PipelineStopsWhenConsumerCloses) {
+    std::string source;
+    for (int i = 0; i < 10000; i++)
+        source += "x = " + std::to_string(i) + ";\n";
+    StatementQueue statements(1);
+    std::thread parser([&] { parse_pipelined(source, statements); });
+    ASSERT_TRUE(statements.pop().has_value());
+    statements.close();
+    parser.join();
+    // The parser may have pushed one more statement before the close, but
+    // with a capacity of 1 no more than that.
+    statements.pop();
+    EXPECT_FALSE(statements.pop().has_value());
+}
+
+TEST(ParserTestSuite, ParseNextToplevelStreams) {
+    const std::string source = "let f x =\n  return x + 1;\nend\nlet v = 2;\nf v;\n";
+    ASTContext all;
+    const auto expected = print_all(all, parse(source, all, 1));
+
+    auto lexer = Lexer(source);
+    auto tokens = TokenStream(lexer);
+    ASTContext ctx;
+    std::string streamed;
+    std::size_t largest = 0;
+    for (auto root = parse_next_toplevel(tokens, ctx); root != no_node; root = parse_next_toplevel(tokens, ctx)) {
+        streamed += print_all(ctx, {root});
+        largest = std::max(largest, ctx.size());
+        ctx.reset();
+    }
+    EXPECT_EQ(streamed, expected);
+    EXPECT_LT(largest, all.size());
+    EXPECT_EQ(parse_next_toplevel(tokens, ctx), no_node);
+}
@@ -0,0 +1,69 @@
+//
+// Created by jonathan on 10/17/26.
+//
+// Lexer throughput on large generated sources, once per scan kernel ISA:
+// the lexer on its own, and with identifiers interned as the parser does.
+// Usage: lex_bench [megabytes]
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <utility>
+
+#include "lex.hpp"
+#include "lex_simd.hpp"
+#include "symbol.hpp"
+
+std::string generate_source(const std::size_t bytes) {
+    std::string source;
+    source.reserve(bytes + 256);
+    for (std::size_t i = 0; source.size() < bytes; i++) {
+        const auto n = std::to_string(i);
+        source += "# generated function number " + n + ", nothing to see here\n";
+        source += "let generated_function_" + n + " first_argument second_argument =\n";
+        source += "        let intermediate_value = first_argument * 1234567.875 + second_argument;\n";
+        source += "        let another_value = call_helper intermediate_value (second_argument - 42);\n";
+        source += "        return intermediate_value + another_value / 3.14159265358979;\n";
+        source += "end\n\n";
+    }
+    return source;
+}
+
+// Best time of `runs` passes over `source`, and the tokens seen in a pass.
+std::pair<double, std::size_t> time_lexer(const std::string& source, const bool interning, const int runs) {
+    double best = 1e300;
+    std::size_t count = 0;
+    for (int r = 0; r < runs; r++) {
+        const auto start = std::chrono::steady_clock::now();
+        auto lexer = Lexer(source);
+        count = 0;
+        for (auto t = lexer.next(); t.kind() != tok_eof; t = lexer.next()) {
+            if (interning && t.kind() == tok_identifier)
+                intern(lexer.text(t));
+            count++;
+        }
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        best = std::min(best, elapsed.count());
+    }
+    return {best, count};
+}
+
+int main(int argc, char* argv[]) {
+    const auto megabytes = argc > 1 ? std::stoul(argv[1]) : 64ul;
+    const auto source = generate_source(megabytes << 20);
+    constexpr int runs = 5;
+
+    std::cout << "input: " << source.size() / double(1 << 20) << " MiB\n";
+    for (const auto isa : {ScanIsa::scalar, ScanIsa::sse2, ScanIsa::avx2}) {
+        if (set_scan_isa(isa) != isa)
+            continue;
+
+        for (const bool interning : {false, true}) {
+            const auto [best, count] = time_lexer(source, interning, runs);
+            std::cout << scan_isa_name(isa) << (interning ? " + interning" : "") << ": " << count << " tokens, "
+                      << source.size() / best / 1e6 << " MB/s (best of " << runs << ")\n";
+        }
+    }
+    return 0;
+}
@@ -1,11 +1,77 @@
+#include <filesystem>
 #include <iostream>
 #include "include/argparse.hpp"
 #include "src/compiler.hpp"
 #include "src/repl.hpp"
+#include "src/source_handler.hpp"
 
-int handle_source_files(const std::vector<std::string>& files, const bool verbose) {
-    auto c = Compiler(verbose);
-    return c.compile(files);
+std::optional<TieringOptions> tiering_options(const argparse::ArgumentParser& program) {
+    TieringOptions options;
+    options.threshold = program.get<unsigned>("--tier-threshold");
+    if (options.threshold == 0)
+        return std::nullopt;
+    options.level = *opt_level(program.get<std::string>("--tier-level"));
+    return options;
+}
+
+/// Applies the optimization report options, in every mode.
+void configure_reports(Compiler& c, const argparse::ArgumentParser& program) {
+    if (program["--time-passes"] == true)
+        c.timePasses();
+    if (const auto remarks = program.present<std::string>("--opt-remarks"))
+        c.writeRemarks(*remarks);
+}
+
+/// Applies the JIT options to a compiler that runs code with jit().
+void configure_jit(Compiler& c, const argparse::ArgumentParser& program) {
+    if (program["--no-jit-cache"] == false) {
+        ObjectCacheOptions cache;
+        if (const auto dir = program.present<std::string>("--jit-cache-dir"))
+            cache.path = *dir;
+        cache.max_bytes = std::uint64_t(program.get<unsigned>("--jit-cache-size")) * 1024 * 1024;
+        c.enableObjectCache(cache);
+    }
+    if (program["--lazy"] == true)
+        c.enableLazyCompilation();
+    else if (const auto tiering = tiering_options(program))
+        c.enableTiering(*tiering);
+}
+
+int handle_source_files(const std::vector<std::string>& files, const argparse::ArgumentParser& program,
+                        const OptimizationLevel level) {
+    auto c = Compiler(program["verbose"] == true, level, program.get<unsigned>("--jit-threads"));
+    c.setJobs(program.get<unsigned>("jobs"));
+    try {
+        configure_reports(c, program);
+        if (program["--interpreter"] == true) {
+            configure_jit(c, program);
+            for (const auto& file : files)
+                c.jit(SourceBuffer::open(file).view());
+            c.waitForTierUps();
+            c.reportTimings();
+            return 0;
+        }
+        if (const auto status = c.compile(files))
+            return status;
+        const auto output = program.present<std::string>("-o");
+        if (const auto emit = program.present<std::string>("--emit")) {
+            const auto kind = *emit_kind(*emit);
+            c.emit(kind, output.value_or(std::filesystem::path(files.front()).filename()
+                                                 .replace_extension(emit_extension(kind)).string()));
+        } else if (output) {
+            c.link(*output);
+        }
+        return 0;
+    } catch (const ParsingException& e) {
+        std::cerr << "error: " << e.what() << std::endl;
+        return 1;
+    } catch (const CodeGenerationException& e) {
+        std::cerr << "error: " << e.what() << std::endl;
+        return 1;
+    } catch (const SourceException& e) {
+        std::cerr << "error: " << e.what() << std::endl;
+        return 1;
+    }
 }
 
 int main(int argc, char* argv[]) {
@@ -14,16 +80,77 @@ int main(int argc, char* argv[]) {
     program.add_argument("source_files")
             .remaining()
             .default_value(std::vector<std::string>())
-            .help("The list of input source files to be compiled");
+            .help("The list of input source files to be compiled, '-' reads stdin");
 
     program.add_argument("--verbose")
             .help("Increase output verbosity.")
             .flag();
 
+    program.add_argument("-j", "--jobs")
+            .help("Number of compiler threads, 0 for one per hardware thread.")
+            .default_value(0u)
+            .scan<'u', unsigned>();
+
+    auto& optimization = program.add_mutually_exclusive_group();
+    optimization.add_argument("-O0").help("Do not optimize.").flag();
+    optimization.add_argument("-O1").help("Optimize quickly.").flag();
+    optimization.add_argument("-O2").help("Optimize (the default).").flag();
+    optimization.add_argument("-O3").help("Optimize aggressively.").flag();
+    optimization.add_argument("-Os").help("Optimize for size.").flag();
+
+    program.add_argument("--time-passes")
+            .help("Report the wall time spent in each optimization pass.")
+            .flag();
+
+    program.add_argument("--opt-remarks")
+            .help("Write the optimizations that fired or were missed to a YAML file.")
+            .metavar("FILE");
+
+    program.add_argument("--emit")
+            .help("Write the compiled program out as an object file, assembly, LLVM IR or LLVM bitcode.")
+            .choices("obj", "asm", "llvm-ir", "llvm-bc");
+
+    program.add_argument("-o")
+            .help("Output file; without --emit, the program is linked into this executable.")
+            .metavar("FILE");
+
     program.add_argument("--interpreter")
+        .help("Run the source files on the JIT instead of compiling them.")
         .default_value(false)
         .implicit_value(true);
 
+    program.add_argument("--jit-threads")
+            .help("Number of threads the JIT compiles on, 0 for one per hardware thread.")
+            .default_value(0u)
+            .scan<'u', unsigned>();
+
+    program.add_argument("--lazy")
+            .help("Have the JIT compile each function on its first call, instead of tiering.")
+            .flag();
+
+    program.add_argument("--jit-cache-dir")
+            .help("Directory the JIT keeps compiled code in between runs (default ~/.cache/ellis).")
+            .metavar("DIR");
+
+    program.add_argument("--jit-cache-size")
+            .help("Size in MiB the JIT cache is pruned to, least recently used first; 0 for no limit.")
+            .default_value(256u)
+            .scan<'u', unsigned>();
+
+    program.add_argument("--no-jit-cache")
+            .help("Compile everything the JIT runs, without reading or writing the cache.")
+            .flag();
+
+    program.add_argument("--tier-threshold")
+            .help("Calls after which the JIT recompiles a function optimized, 0 to optimize everything up front.")
+            .default_value(1000u)
+            .scan<'u', unsigned>();
+
+    program.add_argument("--tier-level")
+            .help("Optimization level of recompiled hot functions.")
+            .default_value(std::string("2"))
+            .choices("2", "3");
+
     try {
         program.parse_args(argc, argv);
     }
@@ -35,8 +162,26 @@ int main(int argc, char* argv[]) {
 
     const auto files = program.get<std::vector<std::string>>("source_files");
 
-    if (files.empty())
-        return repl();
+    if (files.empty()) {
+        // Each line is compiled as it is entered, so favour compile time.
+        auto c = Compiler(true, OptimizationLevel::O1, program.get<unsigned>("--jit-threads"));
+        try {
+            configure_reports(c, program);
+        } catch (const CodeGenerationException& e) {
+            std::cerr << "error: " << e.what() << std::endl;
+            return 1;
+        }
+        configure_jit(c, program);
+        const auto status = repl(c);
+        c.waitForTierUps();
+        c.reportTimings();
+        return status;
+    }
+
+    auto level = OptimizationLevel::O2;
+    for (const auto* name : {"0", "1", "2", "3", "s"})
+        if (program[std::string("-O") + name] == true)
+            level = *opt_level(name);
 
-    return handle_source_files(files, program["verbose"] == true);
+    return handle_source_files(files, program, level);
 }
@@ -5,51 +5,174 @@
 #include "ast.hpp"
 
 
-void NumberExprAST::Accept(Visitor& v) {
-    v.Visit(*this);
-}
+namespace {
 
-void CharExprAST::Accept(Visitor& v) {
-    v.Visit(*this);
-}
+class ASTPrinter : public ASTVisitor<ASTPrinter> {
+    std::ostream& stream;
 
-void StringExprAST::Accept(Visitor& v) {
-    v.Visit(*this);
-}
+    void printList(const NodeRange& nodes) {
+        for (const auto n : nodes) {
+            stream << "\t";
+            visit(n);
+            stream << "\n";
+        }
+    }
+public:
+    explicit ASTPrinter(std::ostream& stream) : stream(stream) {}
 
-void PrototypeAST::Accept(Visitor &v) {
-    v.Visit(*this);
-}
+    void Visit(UnitExprAST) {
+        stream << "Unit()";
+    }
 
-void FunctionAST::Accept(Visitor& v) {
-    v.Visit(*this);
-}
+    void Visit(const NumberExprAST ast) {
+        stream << "Number(";
+        if (ast.isInteger())
+            stream << ast.getIntVal();
+        else
+            stream << ast.getVal();
+        stream << ")";
+    }
 
-void IfAST::Accept(Visitor& v) {
-    v.Visit(*this);
-}
+    void Visit(const StringExprAST ast) {
+        stream << "String(" << ast.getVal() << ")";
+    }
 
-void VariableDefAST::Accept(Visitor& v) {
-    v.Visit(*this);
-}
+    void Visit(const CharExprAST ast) {
+        stream << "Char(" << ast.getVal() << ")";
+    }
 
-void VariableExprAST::Accept(Visitor& v) {
-    v.Visit(*this);
-}
+    void Visit(const VariableExprAST ast) {
+        stream << "Variable(" << ast.getName() << ")";
+    }
 
-void BinaryExprAST::Accept(Visitor& v) {
-    v.Visit(*this);
-}
+    void Visit(const VariableDefAST ast) {
+        stream << "VariableDef(" << ast.getName() << " = ";
+        visit(ast.getValue());
+        stream << ")";
+    }
 
-void CallExprAST::Accept(Visitor& v) {
-    v.Visit(*this);
-}
+    void Visit(const BinaryExprAST ast) {
+        stream << ast.getOpName() << "(";
+        visit(ast.getLHS());
+        stream << " , ";
+        visit(ast.getRHS());
+        stream << ")";
+    }
 
-void UnitExprAST::Accept(Visitor& v) {
-    v.Visit(*this);
-}
+    void Visit(const CallExprAST ast) {
+        stream << ast.getCallee() << "( ";
+        for (const auto arg : ast.getArgs()) {
+            visit(arg);
+            stream << " ";
+        }
+        stream << ")";
+    }
+
+    void Visit(const PrototypeAST ast) {
+        stream << ast.getName() << "( ";
+        for (const auto arg : ast.getArgs())
+            stream << symbol_name(arg) << " ";
+        stream << ")";
+    }
+
+    void Visit(const FunctionAST ast) {
+        stream << "Function ";
+        visit(ast.getProto());
+        stream << "\n";
+        printList(ast.getBody());
+    }
+
+    void Visit(const ReturnAST ast) {
+        stream << "Return(";
+        if (ast.hasRetExpr())
+            visit(ast.getRetExpr());
+        stream << ")";
+    }
+
+    void Visit(const IfAST ast) {
+        stream << "If(  ";
+        visit(ast.getCondition());
+        stream << ") then \n";
+        printList(ast.getThen());
+        stream << " else \n";
+        printList(ast.getElse());
+    }
+};
 
-void ReturnAST::Accept(Visitor &v) {
-    v.Visit(*this);
+} // namespace
+
+void AST::print(std::ostream& stream) const {
+    ASTPrinter(stream).visit(*this);
 }
 
+NodeId ASTContext::append(const ASTContext& other) {
+    const auto node_base = static_cast<NodeId>(kinds.size());
+    const auto list_base = static_cast<ListId>(lists.size() - 1); // other's empty list 0 is shared
+    const auto number_base = static_cast<std::uint32_t>(numbers.size());
+    const auto chars_base = static_cast<std::uint32_t>(chars.size());
+
+    kinds.insert(kinds.end(), other.kinds.begin(), other.kinds.end());
+    for (int slot = 0; slot < 3; slot++)
+        operands[slot].insert(operands[slot].end(), other.operands[slot].begin(), other.operands[slot].end());
+    lists.insert(lists.end(), other.lists.begin() + 1, other.lists.end());
+    numbers.insert(numbers.end(), other.numbers.begin(), other.numbers.end());
+    chars.append(other.chars);
+
+    const auto node = [&](std::uint32_t& id) {
+        if (id != no_node)
+            id += node_base;
+    };
+    const auto list = [&](std::uint32_t& id) {
+        if (id != 0)
+            id += list_base;
+    };
+    // Each list belongs to exactly one node, so its items are rewritten once.
+    const auto node_list = [&](std::uint32_t& id) {
+        list(id);
+        if (id != 0)
+            for (auto i = id + 1; i <= id + lists[id]; i++)
+                lists[i] += node_base;
+    };
+
+    for (auto id = node_base; id < kinds.size(); id++) {
+        auto& a = operands[0][id];
+        auto& b = operands[1][id];
+        auto& c = operands[2][id];
+        switch (kinds[id]) {
+            case NodeKind::Number:
+                a += number_base;
+                break;
+            case NodeKind::String:
+                a += chars_base;
+                break;
+            case NodeKind::VariableDef:
+                node(b);
+                break;
+            case NodeKind::Binary:
+                node(b);
+                node(c);
+                break;
+            case NodeKind::Call:
+                node_list(b);
+                break;
+            case NodeKind::Prototype:
+                list(b); // parameter Symbols, not nodes
+                break;
+            case NodeKind::Function:
+                node(a);
+                node_list(b);
+                break;
+            case NodeKind::Return:
+                node(a);
+                break;
+            case NodeKind::If:
+                node(a);
+                node_list(b);
+                node_list(c);
+                break;
+            default:
+                break;
+        }
+    }
+    return node_base;
+}
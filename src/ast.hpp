@@ -5,6 +5,7 @@
 #ifndef AST_HPP
 #define AST_HPP
 
+#include <cstdint>
 #include <memory>
 #include <ostream>
 #include <string>
@@ -12,300 +13,162 @@
 #include <vector>
 
 #include "llvm/IR/BasicBlock.h"
+#include "llvm/Support/ErrorHandling.h"
+#include "ast_context.hpp"
+#include "symbol.hpp"
 
 using namespace llvm;
 
 
-class Visitor;
+class AST;
 
-union Code {
-    Value* v;
-    Function* f;
+/// NodeRange - The nodes of one child list, as AST handles.
+class NodeRange {
+    ASTContext* ctx;
+    llvm::ArrayRef<NodeId> ids;
+public:
+    class iterator {
+        ASTContext* ctx;
+        const NodeId* it;
+    public:
+        iterator(ASTContext* ctx, const NodeId* it) : ctx(ctx), it(it) {}
+        AST operator*() const;
+        iterator& operator++() { ++it; return *this; }
+        bool operator!=(const iterator& other) const { return it != other.it; }
+    };
+
+    NodeRange(ASTContext& ctx, const ListId list) : ctx(&ctx), ids(ctx.items(list)) {}
+    iterator begin() const { return {ctx, ids.begin()}; }
+    iterator end() const { return {ctx, ids.end()}; }
+    std::size_t size() const { return ids.size(); }
+    bool empty() const { return ids.empty(); }
+    AST operator[](std::size_t i) const;
+    AST back() const;
 };
 
+/// AST - Handle to one node of an ASTContext. Handles are two words, are
+/// passed by value and read everything from the context's arrays; the
+/// classes below only add typed accessors for each NodeKind.
 class AST {
-public:
-    virtual ~AST() = default;
-    virtual void print(std::ostream& stream) const {
-        stream << "AST";
-    }
-    virtual void Accept(Visitor& v) = 0;
-    virtual Code getCode() = 0;
-    friend class Visitor;
-};
+protected:
+    ASTContext* ctx;
+    NodeId id;
 
-class ExprAST : public AST{
+    std::uint32_t operand(const unsigned slot) const { return ctx->operand(id, slot); }
+    AST node(const NodeId other) const { return {*ctx, other}; }
 public:
-    virtual ~ExprAST() = default;
-    void print(std::ostream& stream) const override {
-        stream << "ExprAST";
-    }
-    virtual void Accept(Visitor& v) = 0;
-    virtual Code getCode() = 0;
-};
+    AST(ASTContext& ctx, const NodeId id) : ctx(&ctx), id(id) {}
 
-class StatementAST : public AST {
-public:
-    virtual ~StatementAST() = default;
-    void print(std::ostream& stream) const override {
-        stream << "StatementAST";
-    }
-    virtual void Accept(Visitor& v) = 0;
-    virtual Code getCode() = 0;
+    NodeKind kind() const { return ctx->kind(id); }
+    NodeId getId() const { return id; }
+    ASTContext& getContext() const { return *ctx; }
+    /// Views this node as the handle class of its kind; not checked.
+    template<typename T>
+    T as() const { return T(*ctx, id); }
+
+    void print(std::ostream& stream) const;
 };
 
-class UnitExprAST : public ExprAST {
-    Code code;
-public:
-    void print(std::ostream& stream) const override {
-        stream << "Unit()";
-    }
-    void Accept(Visitor& v) override;
-    void setCode(Value* c) { code.v = c; }
-    Code getCode() override { return code; }
+inline AST NodeRange::iterator::operator*() const { return {*ctx, *it}; }
+inline AST NodeRange::operator[](const std::size_t i) const { return {*ctx, ids[i]}; }
+inline AST NodeRange::back() const { return {*ctx, ids.back()}; }
 
+class UnitExprAST : public AST {
+public:
+    using AST::AST;
 };
 
-/// NumberExprAST - Expression class for numeric literals like "1.0".
-class NumberExprAST : public ExprAST {
-    double val;
-    Code code;
+/// NumberExprAST - Expression class for numeric literals like "1.0" or "42".
+/// Integer literals keep their exact 64-bit value alongside the double.
+class NumberExprAST : public AST {
 public:
-    explicit NumberExprAST(const double Val) : val(Val) {}
-
-    void print(std::ostream& stream) const override {
-        stream << "Number(" << val << ")";
+    using AST::AST;
+    bool isInteger() const { return operand(1) != 0; }
+    std::int64_t getIntVal() const { return ctx->number(operand(0)).integer; }
+    double getVal() const {
+        const auto& n = ctx->number(operand(0));
+        return isInteger() ? static_cast<double>(n.integer) : n.floating;
     }
-
-    void Accept(Visitor& v) override;
-    double getVal() { return val; }
-    void setCode(Value* c) { code.v = c; }
-    Code getCode() override { return code; }
-
 };
 
-class StringExprAST : public ExprAST {
-    std::string val;
-    Code code;
+class StringExprAST : public AST {
 public:
-    explicit StringExprAST(std::string Val) : val(std::move(Val)) {}
-    void print (std::ostream& stream) const override {
-        stream << "String(" << val << ")";
-    }
-    void Accept(Visitor& v) override;
-    std::string getVal() { return val; }
-    void setCode(Value* c) { code.v = c; }
-    Code getCode() override { return code; }
-
+    using AST::AST;
+    std::string_view getVal() const { return ctx->text(operand(0), operand(1)); }
 };
 
-class CharExprAST : public ExprAST {
-    char val;
-    Code code;
+class CharExprAST : public AST {
 public:
-    explicit CharExprAST(char Val) : val(Val) {}
-    void print (std::ostream& stream) const override {
-        stream << "Char(" << val << ")";
-    }
-    void Accept(Visitor& v) override;
-    char getVal() { return val; }
-    void setCode(Value* c) { code.v = c; }
-    Code getCode() override { return code; }
-
+    using AST::AST;
+    char getVal() const { return static_cast<char>(operand(0)); }
 };
 
-class VariableExprAST : public ExprAST {
-    std::string name;
-    Code code;
+class VariableExprAST : public AST {
 public:
-    explicit VariableExprAST(std::string Name) : name(std::move(Name)) {}
-
-    void print (std::ostream& stream) const override {
-        stream << "Variable(" << name << ")";
-    }
-    void Accept(Visitor& v) override;
-    std::string getName() { return name; }
-    void setCode(Value* c) { code.v = c; }
-    Code getCode() override { return code; }
-
+    using AST::AST;
+    Symbol getSymbol() const { return operand(0); }
+    const std::string& getName() const { return symbol_name(getSymbol()); }
 };
 
-class VariableDefAST : public StatementAST {
-    std::string name;
-    std::unique_ptr<ExprAST> value;
-    Code code;
+class VariableDefAST : public AST {
 public:
-    VariableDefAST(std::string Name, std::unique_ptr<ExprAST> v)
-                    : name(std::move(Name)), value(std::move(v)) {}
-
-    void print (std::ostream& stream) const override {
-        stream << "VariableDef(" << name << " = ";
-        value->print(stream);
-        stream << ")";
-    }
-    void Accept(Visitor& v) override;
-    std::string getName() { return name; }
-    void setCode(Value* c) { code.v = c; }
-    Code getCode() override { return code; }
-    ExprAST& getValue() { return *value; }
+    using AST::AST;
+    Symbol getSymbol() const { return operand(0); }
+    const std::string& getName() const { return symbol_name(getSymbol()); }
+    AST getValue() const { return node(operand(1)); }
 };
 
 /// BinaryExprAST - Expression class for a binary operator.
-class BinaryExprAST : public ExprAST {
-    std::string Op;
-    std::unique_ptr<ExprAST> LHS, RHS;
-    Code code;
+class BinaryExprAST : public AST {
 public:
-    BinaryExprAST(std::string Op, std::unique_ptr<ExprAST> LHS,
-                  std::unique_ptr<ExprAST> RHS)
-        : Op(std::move(Op)), LHS(std::move(LHS)), RHS(std::move(RHS)) {}
-
-    void print (std::ostream& stream) const override {
-        stream << Op << "(";
-        LHS->print(stream);
-
-        stream << " , ";
-        RHS->print(stream);
-        stream << ")";
-    }
-    void Accept(Visitor& v) override;
-    void setCode(Value* c) { code.v = c; }
-    Code getCode() override { return code; }
-    ExprAST& getLHS() { return *LHS; }
-    ExprAST& getRHS() { return *RHS; }
-    std::string& getOp() { return Op; }
+    using AST::AST;
+    OperatorKind getOp() const { return static_cast<OperatorKind>(operand(0)); }
+    std::string_view getOpName() const { return operator_spelling(getOp()); }
+    AST getLHS() const { return node(operand(1)); }
+    AST getRHS() const { return node(operand(2)); }
 };
 
 /// CallExprAST - Expression class for function calls.
-class CallExprAST : public ExprAST {
-    std::string Callee;
-    std::vector<std::unique_ptr<ExprAST>> Args;
-    Code code;
+class CallExprAST : public AST {
 public:
-    CallExprAST(std::string Callee,
-                std::vector<std::unique_ptr<ExprAST>> Args)
-        : Callee(std::move(Callee)), Args(std::move(Args)) {}
-
-    void print (std::ostream& stream) const override {
-        stream << Callee << "( ";
-
-        for (const auto& arg : Args) {
-            arg->print(stream);
-            stream << " ";
-        }
-        stream << ")";
-    }
-    void Accept(Visitor& v) override;
-    void setCode(Value* c) { code.v = c; }
-    std::string getCallee() { return Callee; }
-    const std::vector<std::unique_ptr<ExprAST>>& getArgs() { return Args; }
-    Code getCode() override { return code; }
+    using AST::AST;
+    Symbol getCalleeSymbol() const { return operand(0); }
+    const std::string& getCallee() const { return symbol_name(getCalleeSymbol()); }
+    NodeRange getArgs() const { return {*ctx, operand(1)}; }
 };
 
 /// PrototypeAST - This class represents the "prototype" for a function,
 /// which captures its name, and its argument names (thus implicitly the number
 /// of arguments the function takes).
-class PrototypeAST {
-    std::string Name;
-    std::vector<std::string> Args;
-    Code code;
+class PrototypeAST : public AST {
 public:
-    PrototypeAST(std::string Name, std::vector<std::string> Args)
-        : Name(std::move(Name)), Args(std::move(Args)) {}
-
-    const std::string &getName() const { return Name; }
-
-    void print(std::ostream& stream) const {
-        stream << Name << "( ";
-        for (const auto& arg: Args)
-            stream << arg << " ";
-        stream << ")";
-    }
-    void Accept(Visitor& v);
-    std::vector<std::string>& getArgs() { return Args; }
-    std::string& getName() { return Name; }
-    void setCode(Function* f) { code.f = f; }
+    using AST::AST;
+    llvm::ArrayRef<Symbol> getArgs() const { return ctx->items(operand(1)); }
+    Symbol getSymbol() const { return operand(0); }
+    const std::string& getName() const { return symbol_name(getSymbol()); }
 };
 
 /// FunctionAST - This class represents a function definition itself.
-class FunctionAST : public StatementAST {
-    std::unique_ptr<PrototypeAST> Proto;
-    std::vector<std::unique_ptr<AST>> body;
-    Code code;
+class FunctionAST : public AST {
 public:
-    FunctionAST(std::unique_ptr<PrototypeAST> Proto,
-                std::vector<std::unique_ptr<AST>> Body)
-        : Proto(std::move(Proto)), body(std::move(Body)) {}
-
-    void print(std::ostream& stream) const {
-        stream << "Function ";
-        Proto->print(stream);
-        stream << "\n";
-        for (const auto &n : body) {
-            stream << "\t";
-            n->print(stream);
-            stream << "\n";
-        }
-    }
-    void Accept(Visitor& v);
-    void setCode(Function* c) { code.f = c; }
-    Code getCode() { return code; }
-    PrototypeAST& getProto() { return *Proto; }
-    std::vector<std::unique_ptr<AST>>& getBody() { return body; }
+    using AST::AST;
+    PrototypeAST getProto() const { return {*ctx, operand(0)}; }
+    NodeRange getBody() const { return {*ctx, operand(1)}; }
 };
 
-class ReturnAST: public StatementAST {
-    std::unique_ptr<ExprAST> ret;
-    Code code;
+class ReturnAST: public AST {
 public:
-    ReturnAST(std::unique_ptr<ExprAST> returnValue) : ret(std::move(returnValue)) {}
-    ReturnAST() {
-        ret = nullptr;
-    }
-    void print(std::ostream& stream) const override {
-        stream << "Return(";
-        if (ret != nullptr) {
-            ret->print(stream);
-        }
-        stream << ")";
-    }
-    void Accept(Visitor& v) override;
-    void setCode(Value* c) { code.v = c; }
-    Code getCode() { return code; }
-    ExprAST& getRetExpr() {return *ret; }
+    using AST::AST;
+    bool hasRetExpr() const { return operand(0) != no_node; }
+    AST getRetExpr() const { return node(operand(0)); }
 };
 
-class IfAST : public StatementAST {
-    std::unique_ptr<ExprAST> condition;
-    std::vector<std::unique_ptr<AST>> body_on_true;
-    std::vector<std::unique_ptr<AST>> body_on_false;
-    Code code;
+class IfAST : public AST {
 public:
-    IfAST(std::unique_ptr<ExprAST> cond,
-          std::vector<std::unique_ptr<AST>> BodyOnTrue,
-          std::vector<std::unique_ptr<AST>> BodyOnFalse)
-        : condition(std::move(cond)), body_on_true(std::move(BodyOnTrue)), body_on_false(std::move(BodyOnFalse)) {}
-
-    void print(std::ostream& stream) const override {
-        stream << "If(  ";
-        condition->print(stream);
-        stream << ") then \n";
-        for (const auto &n : body_on_true) {
-            stream << "\t";
-            n->print(stream);
-            stream << "\n";
-        }
-        stream << " else \n";
-        for (const auto &n : body_on_false) {
-            stream << "\t";
-            n->print(stream);
-            stream << "\n";
-        }
-    }
-    void Accept(Visitor& v) override;
-    void setCode(Value* c) { code.v = c; }
-    Code getCode() override { return code; }
-
+    using AST::AST;
+    AST getCondition() const { return node(operand(0)); }
+    NodeRange getThen() const { return {*ctx, operand(1)}; }
+    NodeRange getElse() const { return {*ctx, operand(2)}; }
 };
 
 inline std::ostream& operator<<(std::ostream& os, const AST& a ) {
@@ -313,28 +176,53 @@ inline std::ostream& operator<<(std::ostream& os, const AST& a ) {
     return os;
 }
 
-inline std::unique_ptr<ExprAST> LogError(const char *Str) {
+inline void LogError(const char *Str) {
     fprintf(stderr, "Error: %s\n", Str);
-    return nullptr;
 }
 
-class Visitor {
-public:
-    // These are for dispatching on visitor's type.
-    virtual void Visit(VariableExprAST& ast) = 0;
-    virtual void Visit(NumberExprAST& ast) = 0;
-    virtual void Visit(StringExprAST& ast) = 0;
-    virtual void Visit(CharExprAST& ast) = 0;
-    virtual void Visit(IfAST& ast) = 0;
-    virtual void Visit(BinaryExprAST& ast) = 0;
-    virtual void Visit(FunctionAST& ast) = 0;
-    virtual void Visit(CallExprAST& ast) = 0;
-    virtual void Visit(VariableDefAST& ast) = 0;
-    virtual void Visit(UnitExprAST& ast) = 0;
-    virtual void Visit(ReturnAST& ast) = 0;
-    virtual void Visit(PrototypeAST& ast) = 0;
+/// ASTVisitor - Statically dispatched visitor. visit() switches on the
+/// node's kind and calls Derived::Visit with the matching handle class; the
+/// call is resolved at compile time, so it can be inlined. Each Visit returns
+/// its result by value as an R:
+///
+///     class Counter : public ASTVisitor<Counter, int> {
+///     public:
+///         int Visit(NumberExprAST) { return 1; }
+///         ...
+///     };
+template<typename Derived, typename R = void>
+class ASTVisitor {
+public:
+    R visit(const AST node) {
+        auto& self = *static_cast<Derived*>(this);
+        switch (node.kind()) {
+            case NodeKind::Unit:
+                return self.Visit(node.as<UnitExprAST>());
+            case NodeKind::Number:
+                return self.Visit(node.as<NumberExprAST>());
+            case NodeKind::String:
+                return self.Visit(node.as<StringExprAST>());
+            case NodeKind::Char:
+                return self.Visit(node.as<CharExprAST>());
+            case NodeKind::Variable:
+                return self.Visit(node.as<VariableExprAST>());
+            case NodeKind::VariableDef:
+                return self.Visit(node.as<VariableDefAST>());
+            case NodeKind::Binary:
+                return self.Visit(node.as<BinaryExprAST>());
+            case NodeKind::Call:
+                return self.Visit(node.as<CallExprAST>());
+            case NodeKind::Prototype:
+                return self.Visit(node.as<PrototypeAST>());
+            case NodeKind::Function:
+                return self.Visit(node.as<FunctionAST>());
+            case NodeKind::Return:
+                return self.Visit(node.as<ReturnAST>());
+            case NodeKind::If:
+                return self.Visit(node.as<IfAST>());
+        }
+        llvm_unreachable("unknown NodeKind");
+    }
 };
 
-
-
 #endif //AST_HPP
@@ -0,0 +1,160 @@
+//
+// Created by jonathan on 10/17/26.
+//
+
+#ifndef ELLIS_AST_CONTEXT_HPP
+#define ELLIS_AST_CONTEXT_HPP
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "llvm/ADT/ArrayRef.h"
+#include "lex.hpp"
+#include "symbol.hpp"
+
+/// NodeKind - Tag stored for every node; it decides how the node's operand
+/// slots are read (see the builders of ASTContext below).
+enum class NodeKind : std::uint8_t {
+    Unit,
+    Number,
+    String,
+    Char,
+    Variable,
+    VariableDef,
+    Binary,
+    Call,
+    Prototype,
+    Function,
+    Return,
+    If,
+};
+
+/// Index of a node in its ASTContext.
+typedef std::uint32_t NodeId;
+constexpr NodeId no_node = UINT32_MAX;
+
+/// Offset of a length-prefixed list in the shared index array of an
+/// ASTContext. List 0 is always the empty list.
+typedef std::uint32_t ListId;
+
+/// ASTContext - Flat, data-oriented storage for every node of a compilation
+/// unit. A node is an index into parallel arrays: its kind and three 32-bit
+/// operand slots holding child NodeIds, Symbols, payload indices or ListIds.
+/// Child lists (call arguments, bodies, parameter names) are runs of
+/// [count, item...] in one shared index array, and literal payloads live in
+/// their own arrays.
+///
+/// Nodes are only ever appended and always after their children, so walking
+/// the tree touches the arrays front to back and a sweep over all nodes is a
+/// plain loop over 0..size().
+class ASTContext {
+    std::vector<NodeKind> kinds;
+    std::vector<std::uint32_t> operands[3];
+    std::vector<std::uint32_t> lists = {0};
+    std::vector<NumberValue> numbers;
+    std::string chars;
+
+    NodeId add(const NodeKind kind, const std::uint32_t a = 0,
+               const std::uint32_t b = 0, const std::uint32_t c = 0) {
+        const auto id = static_cast<NodeId>(kinds.size());
+        kinds.push_back(kind);
+        operands[0].push_back(a);
+        operands[1].push_back(b);
+        operands[2].push_back(c);
+        return id;
+    }
+public:
+    ASTContext() = default;
+    ASTContext(const ASTContext&) = delete;
+    ASTContext& operator=(const ASTContext&) = delete;
+
+    // Builders. The comment after each one gives its operand slots.
+
+    NodeId unit() { return add(NodeKind::Unit); }
+    NodeId integer(const std::int64_t value) { // number index, 1
+        NumberValue n;
+        n.integer = value;
+        numbers.push_back(n);
+        return add(NodeKind::Number, static_cast<std::uint32_t>(numbers.size() - 1), 1);
+    }
+    NodeId floating(const double value) { // number index, 0
+        NumberValue n;
+        n.floating = value;
+        numbers.push_back(n);
+        return add(NodeKind::Number, static_cast<std::uint32_t>(numbers.size() - 1), 0);
+    }
+    NodeId string(const std::string_view value) { // chars offset, length
+        const auto offset = static_cast<std::uint32_t>(chars.size());
+        chars.append(value);
+        return add(NodeKind::String, offset, static_cast<std::uint32_t>(value.size()));
+    }
+    NodeId character(const char value) { // char
+        return add(NodeKind::Char, static_cast<unsigned char>(value));
+    }
+    NodeId variable(const Symbol name) { // name
+        return add(NodeKind::Variable, name);
+    }
+    NodeId variableDef(const Symbol name, const NodeId value) { // name, value
+        return add(NodeKind::VariableDef, name, value);
+    }
+    NodeId binary(const OperatorKind op, const NodeId lhs, const NodeId rhs) { // op, lhs, rhs
+        return add(NodeKind::Binary, static_cast<std::uint32_t>(op), lhs, rhs);
+    }
+    NodeId call(const Symbol callee, const ListId args) { // callee, args
+        return add(NodeKind::Call, callee, args);
+    }
+    NodeId prototype(const Symbol name, const ListId args) { // name, arg symbols
+        return add(NodeKind::Prototype, name, args);
+    }
+    NodeId function(const NodeId proto, const ListId body) { // proto, body
+        return add(NodeKind::Function, proto, body);
+    }
+    NodeId ret(const NodeId value = no_node) { // value or no_node
+        return add(NodeKind::Return, value);
+    }
+    NodeId ifElse(const NodeId cond, const ListId onTrue, const ListId onFalse) { // cond, then, else
+        return add(NodeKind::If, cond, onTrue, onFalse);
+    }
+
+    /// Appends a list of NodeIds (or Symbols) and returns its handle.
+    ListId list(llvm::ArrayRef<std::uint32_t> items) {
+        if (items.empty())
+            return 0;
+        const auto id = static_cast<ListId>(lists.size());
+        lists.push_back(static_cast<std::uint32_t>(items.size()));
+        lists.insert(lists.end(), items.begin(), items.end());
+        return id;
+    }
+
+    // Accessors. Views returned here are invalidated by the next builder call.
+
+    std::size_t size() const { return kinds.size(); }
+    NodeKind kind(const NodeId id) const { return kinds[id]; }
+    std::uint32_t operand(const NodeId id, const unsigned slot) const { return operands[slot][id]; }
+    llvm::ArrayRef<std::uint32_t> items(const ListId list) const {
+        return {lists.data() + list + 1, lists[list]};
+    }
+    const NumberValue& number(const std::uint32_t index) const { return numbers[index]; }
+    std::string_view text(const std::uint32_t offset, const std::uint32_t length) const {
+        return std::string_view(chars).substr(offset, length);
+    }
+
+    /// Copies every node of `other` to the end of this context, rewriting its
+    /// NodeIds, ListIds and payload indices, and returns what was added to
+    /// other's NodeIds. Used to merge trees parsed into separate contexts.
+    NodeId append(const ASTContext& other);
+
+    /// Drops every node; NodeIds and ListIds of this context become invalid.
+    void reset() {
+        kinds.clear();
+        for (auto& slots : operands)
+            slots.clear();
+        lists.assign(1, 0);
+        numbers.clear();
+        chars.clear();
+    }
+};
+
+#endif //ELLIS_AST_CONTEXT_HPP
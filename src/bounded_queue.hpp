@@ -0,0 +1,79 @@
+//
+// Created by jonathan on 10/17/26.
+//
+
+#ifndef ELLIS_BOUNDED_QUEUE_HPP
+#define ELLIS_BOUNDED_QUEUE_HPP
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <optional>
+
+/// BoundedQueue - Blocking FIFO between the stages of a pipeline. A producer
+/// that gets `capacity` items ahead of its consumer waits, so the amount of
+/// work in flight (and the memory it holds) stays fixed however long the
+/// input is.
+///
+/// Either side may close() the queue: the producer when it is done or has
+/// failed, the consumer when it gives up, which makes the producer's next
+/// push() return false instead of blocking forever.
+template<typename T>
+class BoundedQueue {
+    std::mutex mutex;
+    std::condition_variable not_full;
+    std::condition_variable not_empty;
+    std::deque<T> items;
+    const std::size_t capacity;
+    bool closed = false;
+    std::exception_ptr error;
+public:
+    explicit BoundedQueue(const std::size_t capacity) : capacity(capacity ? capacity : 1) {}
+    BoundedQueue(const BoundedQueue&) = delete;
+    BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+    /// Appends an item, waiting while the queue is full. Returns false, and
+    /// drops the item, if the queue is closed.
+    bool push(T item) {
+        std::unique_lock lock(mutex);
+        not_full.wait(lock, [&] { return closed || items.size() < capacity; });
+        if (closed)
+            return false;
+        items.push_back(std::move(item));
+        not_empty.notify_one();
+        return true;
+    }
+
+    /// Takes the oldest item, waiting while the queue is empty and open.
+    /// Once it is closed and drained, rethrows the error it was closed with,
+    /// if any, and returns std::nullopt otherwise.
+    std::optional<T> pop() {
+        std::unique_lock lock(mutex);
+        not_empty.wait(lock, [&] { return closed || !items.empty(); });
+        if (items.empty()) {
+            if (error)
+                std::rethrow_exception(error);
+            return std::nullopt;
+        }
+        auto item = std::move(items.front());
+        items.pop_front();
+        not_full.notify_one();
+        return item;
+    }
+
+    /// Ends the stream and wakes every waiting thread. Only the first close
+    /// counts; its `failure` is raised by pop() after the remaining items.
+    void close(const std::exception_ptr failure = nullptr) {
+        std::lock_guard lock(mutex);
+        if (closed)
+            return;
+        closed = true;
+        error = failure;
+        not_full.notify_all();
+        not_empty.notify_all();
+    }
+};
+
+#endif //ELLIS_BOUNDED_QUEUE_HPP
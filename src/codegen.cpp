@@ -3,3 +3,20 @@
 //
 
 #include "codegen.hpp"
+#include <mutex>
+
+void DeclarationTable::declare(const Symbol name, const unsigned arity, const std::string& file) {
+    std::unique_lock lock(mutex);
+    const auto [it, inserted] = declarations.try_emplace(name, Declaration{arity, file});
+    if (!inserted && it->second.file != file)
+        throw CodeGenerationException("Function " + symbol_name(name) + " defined in both "
+                                      + it->second.file + " and " + file);
+}
+
+std::optional<unsigned> DeclarationTable::lookup(const Symbol name) const {
+    std::shared_lock lock(mutex);
+    const auto it = declarations.find(name);
+    if (it == declarations.end())
+        return std::nullopt;
+    return it->second.arity;
+}
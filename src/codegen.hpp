@@ -5,7 +5,9 @@
 #ifndef CODEGEN_HPP
 #define CODEGEN_HPP
 
-#include <map>
+#include <optional>
+#include <shared_mutex>
+#include <unordered_map>
 #include "ast.hpp"
 #include "llvm/ADT/APFloat.h"
 #include "llvm/IR/Constants.h"
@@ -26,24 +28,54 @@ public:
     }
 };
 
-class CodeGenerator: public Visitor {
+/// DeclarationTable - Signatures of the functions every file of a parallel
+/// build defines, filled in after parsing and read by the per-file code
+/// generators so that a call can be emitted against a function whose body
+/// is generated in another module. Safe to use from any thread.
+class DeclarationTable {
+    struct Declaration {
+        unsigned arity;
+        std::string file;
+    };
+    mutable std::shared_mutex mutex;
+    std::unordered_map<Symbol, Declaration> declarations;
+public:
+    /// Records that `file` defines `name`; defining the same function in
+    /// two files throws a CodeGenerationException.
+    void declare(Symbol name, unsigned arity, const std::string& file);
+
+    /// Parameter count of `name`, if some file defines it.
+    std::optional<unsigned> lookup(Symbol name) const;
+};
+
+/// Local variable slots of the function being generated, keyed by symbol.
+typedef std::unordered_map<Symbol, AllocaInst*> NamedValueMap;
+
+/// CodeGenerator - Emits LLVM IR for a tree; each Visit returns the value it
+/// generated (or the Function, for prototypes and definitions).
+class CodeGenerator: public ASTVisitor<CodeGenerator, Value*> {
 
     LLVMContext& TheContext;
     IRBuilder<>& Builder;
     Module& TheModule;
-    std::vector<Value*> code;
+    const DeclarationTable* Declarations;
 
     Value* LogErrorV(const char *Str) {
         LogError(Str);
         return nullptr;
     }
 public:
-    CodeGenerator(LLVMContext& context, IRBuilder<>& builder, Module& module, std::map<std::string, AllocaInst*>* namedValues)
-        : TheContext(context), Builder(builder), TheModule(module), NamedValues(namedValues)  {}
+    CodeGenerator(LLVMContext& context, IRBuilder<>& builder, Module& module, NamedValueMap* namedValues,
+                  const DeclarationTable* declarations = nullptr)
+        : TheContext(context), Builder(builder), TheModule(module), Declarations(declarations),
+          NamedValues(namedValues)  {}
 
-        void Visit(ExprAST& ast) {}
+    NamedValueMap* NamedValues;
 
-    std::map<std::string, AllocaInst*>* NamedValues;
+    AllocaInst* lookupNamedValue(const Symbol name) const {
+        const auto it = NamedValues->find(name);
+        return it == NamedValues->end() ? nullptr : it->second;
+    }
 
     AllocaInst *CreateEntryBlockAlloca(Function *TheFunction,
                                               const std::string &VarName) {
@@ -53,102 +85,92 @@ public:
                                  VarName);
     }
 
-    void Visit(VariableExprAST& ast) override {
-        AllocaInst *V = (*NamedValues)[ast.getName()];
+    Value* Visit(const VariableExprAST ast) {
+        AllocaInst *V = lookupNamedValue(ast.getSymbol());
         if (!V) {
             auto v = TheModule.getGlobalVariable(ast.getName());
-            if (v) {
-                ast.setCode(v);
-            } else
-                LogErrorV("Unknown variable name");
-        }
-        else {
-            auto c = Builder.CreateLoad(V->getAllocatedType(), V, ast.getName().c_str());
-            if (c->getType()->isPointerTy()) {
-                std::cout << "load created successfully";
-            } else {
-                std::cout << "could not create load";
-            }
-            ast.setCode(V);
+            if (!v)
+                return LogErrorV("Unknown variable name");
+            return v;
         }
+        return Builder.CreateLoad(V->getAllocatedType(), V, ast.getName().c_str());
     }
 
-    void Visit(NumberExprAST& ast) override {
-        ast.setCode(ConstantFP::get(TheContext, APFloat(ast.getVal())));
+    Value* Visit(const NumberExprAST ast) {
+        return ConstantFP::get(TheContext, APFloat(ast.getVal()));
     }
 
-    void Visit(VariableDefAST& ast) override {
-        ast.getValue().Accept(*this);
-        auto c = ast.getValue().getCode();
-        auto var = (*NamedValues)[ast.getName()];
-        if (!var) {
-            llvm::Function *parentFunction = Builder.GetInsertBlock()->getParent();
-            if (!parentFunction)
-                std::cout << "couldnt get parent function";
-            llvm::IRBuilder<> TmpBuilder(&(parentFunction->getEntryBlock()),
-                                         parentFunction->getEntryBlock().begin());
-            llvm::AllocaInst *v = TmpBuilder.CreateAlloca(c.v->getType(), nullptr,
-                                                            llvm::Twine(ast.getName()));
-
-            Builder.CreateStore(c.v, v);
-            (*NamedValues)[ast.getName()] = v;
-            ast.setCode(c.v);
-
-        } else {
-            LogErrorV("Variable already declared");
-        }
-        //std::cout << "done\n";
+    Value* Visit(const VariableDefAST ast) {
+        auto c = visit(ast.getValue());
+        auto var = lookupNamedValue(ast.getSymbol());
+        if (var)
+            return LogErrorV("Variable already declared");
+
+        llvm::Function *parentFunction = Builder.GetInsertBlock()->getParent();
+        if (!parentFunction)
+            std::cout << "couldnt get parent function";
+        llvm::IRBuilder<> TmpBuilder(&(parentFunction->getEntryBlock()),
+                                     parentFunction->getEntryBlock().begin());
+        llvm::AllocaInst *v = TmpBuilder.CreateAlloca(c->getType(), nullptr,
+                                                        llvm::Twine(ast.getName()));
+
+        Builder.CreateStore(c, v);
+        (*NamedValues)[ast.getSymbol()] = v;
+        return c;
     }
 
-    void Visit(StringExprAST& ast) override {
-
+    Value* Visit(StringExprAST) {
+        return nullptr;
     }
 
-    void Visit(CharExprAST& ast) override {
+    Value* Visit(CharExprAST) {
+        return nullptr;
+    }
 
+    Value* Visit(IfAST) {
+        return nullptr;
     }
 
-    void Visit(IfAST& ast) override {
+    FunctionType* functionType(const std::size_t arity) {
+        std::vector<Type *> Doubles(arity, Type::getDoubleTy(TheContext));
+        return FunctionType::get(Type::getDoubleTy(TheContext), Doubles, false);
+    }
 
+    /// Declares a function defined in another file of the build, or returns
+    /// nullptr if the declaration table does not know it.
+    Function* declareExternal(const Symbol name) {
+        const auto arity = Declarations ? Declarations->lookup(name) : std::nullopt;
+        if (!arity)
+            return nullptr;
+        return Function::Create(functionType(*arity), Function::ExternalLinkage, symbol_name(name), TheModule);
     }
 
-    void Visit(PrototypeAST& ast) override {
-        std::vector<Type *> Doubles(ast.getArgs().size(), Type::getDoubleTy(TheContext));
-        FunctionType *FT =
-                FunctionType::get(Type::getDoubleTy(TheContext), Doubles, false);
+    Function* Visit(const PrototypeAST ast) {
+        FunctionType *FT = functionType(ast.getArgs().size());
 
-        Function *F =
-                Function::Create(FT, Function::ExternalLinkage, ast.getName(), TheModule);
+        // A call seen before the definition already declared the function.
+        Function *F = TheModule.getFunction(ast.getName());
+        if (!F || !F->isDeclaration() || F->getFunctionType() != FT)
+            F = Function::Create(FT, Function::ExternalLinkage, ast.getName(), TheModule);
 
         // Set names for all arguments.
         unsigned Idx = 0;
         for (auto &Arg : F->args())
-            Arg.setName(ast.getArgs()[Idx++]);
+            Arg.setName(symbol_name(ast.getArgs()[Idx++]));
 
-        ast.setCode(F);
+        return F;
     }
 
-    void Visit(FunctionAST& ast) override {
+    Function* Visit(const FunctionAST ast) {
         // this allows functions to be redefined
         auto Args = ast.getProto().getArgs();
-        std::vector<Type*> Doubles(Args.size(),
-                                   Type::getDoubleTy(TheContext));
-        FunctionType *FT =
-                FunctionType::get(Type::getDoubleTy(TheContext), Doubles, false);
-
-        Function *F =
-                Function::Create(FT, Function::ExternalLinkage, ast.getProto().getName(), TheModule);
-
-        unsigned Idx = 0;
-        for (auto &Arg : F->args())
-            Arg.setName(Args[Idx++]);
+        Function *F = Visit(ast.getProto());
 
         BasicBlock *BB = BasicBlock::Create(TheContext, "entry", F);
         Builder.SetInsertPoint(BB);
 
         // Record the function arguments in the NamedValues map.
-        //(*NamedValues).clear();
-        //auto tempNamedValues = *NamedValues;
+        unsigned Idx = 0;
         for (auto &Arg : F->args()) {
             AllocaInst *Alloca = CreateEntryBlockAlloca(F, Arg.getName().str());
 
@@ -156,69 +178,91 @@ public:
             Builder.CreateStore(&Arg, Alloca);
 
             // Add arguments to variable symbol table.
-            (*NamedValues)[std::string(Arg.getName())] = Alloca;
+            (*NamedValues)[Args[Idx++]] = Alloca;
         }
 
-        for (auto& expr : ast.getBody()) {
-            expr->Accept(*this);
+        // The value of the last statement is returned, unless the body
+        // already ended in an explicit return.
+        Value* RetVal = nullptr;
+        for (const auto expr : ast.getBody()) {
+            RetVal = visit(expr);
         }
 
-        Value* RetVal = ast.getBody().back()->getCode().v;
-        Builder.CreateRet(RetVal);
+        if (!Builder.GetInsertBlock()->getTerminator())
+            Builder.CreateRet(RetVal ? RetVal : ConstantFP::get(TheContext, APFloat(0.0)));
 
         verifyFunction(*F);
-        ast.setCode(F);
-        // doesnt handle return values
-    }
-
-    void Visit(BinaryExprAST& ast) override {
-        ast.getLHS().Accept(*this);
-        ast.getRHS().Accept(*this);
-        auto op = ast.getOp();
-
-        if (op == "+")
-            ast.setCode(Builder.CreateFAdd(ast.getLHS().getCode().v,
-                                           ast.getRHS().getCode().v, "addtmp"));
-        else if (op == "-")
-            ast.setCode(Builder.CreateFSub(ast.getLHS().getCode().v,
-                                           ast.getRHS().getCode().v, "subtmp"));
-        else if (op == "*")
-            ast.setCode(Builder.CreateFMul(ast.getLHS().getCode().v,
-                                           ast.getRHS().getCode().v, "multmp"));
-        else if (op == "<")
-            ast.setCode(Builder.CreateUIToFP(ast.getLHS().getCode().v,
-                                             Type::getDoubleTy(TheContext), "booltmp"));
-        else
-            throw CodeGenerationException("Infix operator not implemented: " + op);
-    }
-
-    void Visit(CallExprAST& ast) override {
+        return F;
+    }
+
+    /// Applies a non-assigning operator, or the operation of a compound
+    /// assignment, as described by its operator table entry.
+    Value* emitOperator(const OperatorInfo& info, Value* L, Value* R) {
+        if (info.opcode != Instruction::BinaryOpsEnd)
+            return Builder.CreateBinOp(info.opcode, L, R, "optmp");
+        if (info.predicate != CmpInst::BAD_FCMP_PREDICATE) {
+            auto cmp = Builder.CreateFCmp(info.predicate, L, R, "cmptmp");
+            return Builder.CreateUIToFP(cmp, Type::getDoubleTy(TheContext), "booltmp");
+        }
+        throw CodeGenerationException("Infix operator not implemented: " + std::string(info.spelling));
+    }
+
+    Value* emitAssignment(const BinaryExprAST ast, const OperatorInfo& info) {
+        const auto target = ast.getLHS();
+        if (target.kind() != NodeKind::Variable)
+            throw CodeGenerationException("Left-hand side of " + std::string(info.spelling) + " must be a variable");
+        const auto var = target.as<VariableExprAST>();
+        AllocaInst* slot = lookupNamedValue(var.getSymbol());
+        if (!slot)
+            throw CodeGenerationException("Unknown variable name: " + var.getName());
+
+        Value* value = visit(ast.getRHS());
+        if (ast.getOp() != OperatorKind::assign) {
+            auto current = Builder.CreateLoad(slot->getAllocatedType(), slot, var.getName());
+            value = emitOperator(info, current, value);
+        }
+        Builder.CreateStore(value, slot);
+        return value;
+    }
+
+    Value* Visit(const BinaryExprAST ast) {
+        const auto& info = operator_info(ast.getOp());
+        if (info.assigns)
+            return emitAssignment(ast, info);
+
+        auto L = visit(ast.getLHS());
+        auto R = visit(ast.getRHS());
+        return emitOperator(info, L, R);
+    }
+
+    Value* Visit(const CallExprAST ast) {
         Function *CalleeF = TheModule.getFunction(ast.getCallee());
+        if (!CalleeF)
+            CalleeF = declareExternal(ast.getCalleeSymbol());
         if (!CalleeF)
             throw CodeGenerationException("Unknown function referenced");
 
-        auto& Args = ast.getArgs();
+        auto Args = ast.getArgs();
         // If argument mismatch error.
         if (CalleeF->arg_size() != Args.size())
             throw CodeGenerationException("Incorrect # arguments passed to function: " + ast.getCallee());
 
         std::vector<Value *> ArgsV;
-        for (auto & Arg : Args) {
-            Arg->Accept(*this);
-            ArgsV.push_back(Arg->getCode().v);
+        for (const auto Arg : Args) {
+            ArgsV.push_back(visit(Arg));
         }
 
-        ast.setCode(Builder.CreateCall(CalleeF, ArgsV, "calltmp"));
+        return Builder.CreateCall(CalleeF, ArgsV, "calltmp");
     }
 
-    void Visit(UnitExprAST& ast) override {
-
+    Value* Visit(UnitExprAST) {
+        return nullptr;
     }
 
-    void Visit(ReturnAST& ast) override {
-        ast.getRetExpr().Accept(*this);
-        Value* retVal = ast.getCode().v;
-        Builder.CreateRet(retVal);
+    Value* Visit(const ReturnAST ast) {
+        Value* retVal = ast.hasRetExpr() ? visit(ast.getRetExpr())
+                                         : ConstantFP::get(TheContext, APFloat(0.0));
+        return Builder.CreateRet(retVal);
     }
 };
 
@@ -2,30 +2,250 @@
 // Created by jonathan on 12/14/23.
 //
 
+#include <optional>
+
 #include "compiler.hpp"
 #include "source_handler.hpp"
 #include "lex.hpp"
 #include "parser.hpp"
 #include "ast.hpp"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/Linker/Linker.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/FileUtilities.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include <thread>
+
 
+void Compiler::printSource(const std::string& file, const std::string_view source) const {
+    std::cout << "File: " << file << "\n";
+    std::cout << "contents: \n";
+    std::cout << source;
+    std::cout << "\n";
+    lex(source, verbose);
+}
 
 int Compiler::compile(const std::vector<std::string>& files) {
+    std::lock_guard lock(frontEnd);
+    const auto strategy = hardware_concurrency(jobs);
+    const bool threaded = strategy.compute_thread_count() > 1;
+    int status;
+    if (threaded && files.size() > 1) {
+        status = compileParallel(files, strategy);
+    } else {
+        status = threaded && files.size() == 1 ? compilePipelined(files.front()) : compileSerial(files);
+        optimizer->run(*module);
+    }
+    reportTimings();
+    return status;
+}
+
+int Compiler::compileSerial(const std::vector<std::string>& files) {
     for (const auto& file : files) {
-        auto file_string = read_file(file);
-        if (verbose) {
-            std::cout << "File: " << file << "\n";
-            std::cout << "contents: \n";
-            std::cout << file_string;
-            std::cout << "\n";
+        const auto source = SourceBuffer::open(file);
+        const auto file_string = source.view();
+        if (verbose)
+            printSource(file, file_string);
+
+        // Each statement is generated as soon as it is parsed and then
+        // dropped, so only the one being compiled is ever held in memory.
+        auto lexer = Lexer(file_string);
+        auto tokens = TokenStream(lexer);
+        ASTContext ctx;
+        for (auto root = parse_next_toplevel(tokens, ctx); root != no_node; root = parse_next_toplevel(tokens, ctx)) {
+            if (verbose)
+                std::cout << AST(ctx, root) << "\n";
+            codeGenerator->visit(AST(ctx, root));
+            ctx.reset();
         }
-        
-        auto tokens = lex(file_string, verbose);
-        auto asts = parse(tokens);
-        for (auto& ast: asts) {
-            ast->Accept(*codeGenerator);
+    }
+    return 0;
+}
+
+int Compiler::compilePipelined(const std::string& file) {
+    const auto source = SourceBuffer::open(file);
+    if (verbose)
+        printSource(file, source.view());
+
+    StatementQueue statements(pipeline_depth);
+    std::thread parser([&] { parse_pipelined(source.view(), statements); });
+    try {
+        while (auto statement = statements.pop()) {
+            auto& [ctx, root] = **statement;
+            if (verbose)
+                std::cout << AST(ctx, root) << "\n";
+            codeGenerator->visit(AST(ctx, root));
         }
+    } catch (...) {
+        statements.close();
+        parser.join();
+        throw;
     }
+    parser.join();
     return 0;
 }
 
+namespace {
+
+/// One file of a parallel compile, from its source to the bitcode of its
+/// module.
+struct CompilationUnit {
+    std::optional<SourceBuffer> source;
+    ASTContext ctx;
+    std::vector<NodeId> asts;
+    SmallVector<char, 0> bitcode;
+    std::exception_ptr error;
+};
+
+/// Runs `task` on every unit in the pool, then rethrows the first error in
+/// file order, so failures are reported as the serial compile would.
+template<typename Task>
+void forEachUnit(ThreadPool& pool, std::vector<CompilationUnit>& units, Task task) {
+    for (std::size_t i = 0; i < units.size(); i++) {
+        pool.async([&, i] {
+            try {
+                task(i, units[i]);
+            } catch (...) {
+                units[i].error = std::current_exception();
+            }
+        });
+    }
+    pool.wait();
+    for (const auto& unit : units)
+        if (unit.error)
+            std::rethrow_exception(unit.error);
+}
+
+} // namespace
+
+int Compiler::compileParallel(const std::vector<std::string>& files, const ThreadPoolStrategy strategy) {
+    std::vector<CompilationUnit> units(files.size());
+    ThreadPool pool(strategy);
 
+    // Parse every file and publish the functions it defines, so that code
+    // generation can declare the ones it calls from other files.
+    forEachUnit(pool, units, [&](const std::size_t i, CompilationUnit& unit) {
+        unit.source.emplace(SourceBuffer::open(files[i]));
+        unit.asts = parse(unit.source->view(), unit.ctx, 1);
+        for (const auto ast : unit.asts) {
+            if (unit.ctx.kind(ast) != NodeKind::Function)
+                continue;
+            const auto proto = FunctionAST(unit.ctx, ast).getProto();
+            declarations.declare(proto.getSymbol(), proto.getArgs().size(), files[i]);
+        }
+    });
+    if (verbose) {
+        for (std::size_t i = 0; i < units.size(); i++) {
+            printSource(files[i], units[i].source->view());
+            for (const auto ast : units[i].asts)
+                std::cout << AST(units[i].ctx, ast) << "\n";
+        }
+    }
+
+    // LLVM contexts are not thread-safe, so each file is generated and
+    // optimized in a context of its own and handed back as bitcode.
+    const auto layout = module->getDataLayout();
+    forEachUnit(pool, units, [&](const std::size_t i, CompilationUnit& unit) {
+        LLVMContext context;
+        Module fileModule(files[i], context);
+        fileModule.setDataLayout(layout);
+        IRBuilder<> fileBuilder(context);
+        NamedValueMap fileValues;
+        CodeGenerator generator(context, fileBuilder, fileModule, &fileValues, &declarations);
+        for (const auto ast : unit.asts)
+            generator.visit(AST(unit.ctx, ast));
+        optimizer->run(fileModule);
+
+        raw_svector_ostream stream(unit.bitcode);
+        WriteBitcodeToFile(fileModule, stream);
+        unit.ctx.reset();
+        unit.asts.clear();
+    });
+
+    for (std::size_t i = 0; i < units.size(); i++) {
+        const auto buffer = MemoryBufferRef(StringRef(units[i].bitcode.data(), units[i].bitcode.size()), files[i]);
+        auto fileModule = ExitOnErr(parseBitcodeFile(buffer, *TheContext));
+        if (Linker::linkModules(*module, std::move(fileModule)))
+            throw CodeGenerationException("Failed to link " + files[i]);
+        units[i].bitcode.clear();
+    }
+    return 0;
+}
+
+void Compiler::emit(const EmitKind kind, const std::string& path) {
+    std::lock_guard lock(frontEnd);
+    add_entry_point(*module);
+    ::emit(*module, kind, path, TheJIT->getTargetMachineBuilder());
+}
+
+void Compiler::link(const std::string& path) {
+    SmallString<128> object;
+    if (const auto error = sys::fs::createTemporaryFile("ellis", "o", object))
+        throw CodeGenerationException("Cannot create a temporary object file: " + error.message());
+    FileRemover remover(object);
+    emit(EmitKind::object, object.str().str());
+    link_executable(object.str().str(), path);
+}
+
+double Compiler::evaluate(const std::string_view source) {
+    ASTContext ctx;
+    auto asts = parse(source, ctx);
+    if (verbose)
+        for (const auto ast : asts)
+            std::cout << AST(ctx, ast) << "\n";
+
+    // Code generation works on the shared module, one source at a time.
+    // Each expression gets an entry point of its own so that several can be
+    // in the JIT at once.
+    std::unique_lock lock(frontEnd);
+    const auto entry = "__anon_expr" + (expressions ? std::to_string(expressions) : "");
+    expressions++;
+
+    // Definitions become functions of their own, which later calls can
+    // reach through the declaration table; everything else is the body of
+    // the entry point.
+    std::vector<NodeId> statements;
+    for (const auto ast : asts) {
+        if (ctx.kind(ast) != NodeKind::Function) {
+            statements.push_back(ast);
+            continue;
+        }
+        const auto definition = FunctionAST(ctx, ast);
+        codeGenerator->visit(definition);
+        const auto proto = definition.getProto();
+        declarations.declare(proto.getSymbol(), proto.getArgs().size(), "<jit>");
+    }
+    auto Proto = ctx.prototype(intern(entry), ctx.list({}));
+    auto anon_fn = FunctionAST(ctx, ctx.function(Proto, ctx.list(statements)));
+    codeGenerator->visit(anon_fn)->print(errs());
+    printf("\n");
+    // Tiered code starts unoptimized and is optimized once it is hot.
+    if (!TheJIT->getTiers())
+        optimizer->run(*module);
+
+    // The expression runs once, from a module of its own that is removed
+    // afterwards; the definitions stay.
+    ValueToValueMapTy VMap;
+    auto expr = CloneModule(*module, VMap, [&](const GlobalValue* GV) { return GV->getName() == entry; });
+    module->getFunction(entry)->eraseFromParent();
+    const bool defines = any_of(module->functions(), [](const Function& F) { return !F.isDeclaration(); });
+
+    orc::ThreadSafeContext TSCtx(std::move(TheContext));
+    if (defines)
+        ExitOnErr(TheJIT->addModule(orc::ThreadSafeModule(std::move(module), TSCtx)));
+    auto RT = TheJIT->getMainJITDylib().createResourceTracker();
+    ExitOnErr(TheJIT->addModule(orc::ThreadSafeModule(std::move(expr), TSCtx), RT));
+    ReinitializeModuleAndManagers();
+    lock.unlock();
+
+    auto ExprSymbol = ExitOnErr(TheJIT->lookup(entry));
+    auto *FP = jitTargetAddressToPointer<double (*)()>(ExprSymbol.getAddress());
+    const double value = FP();
+
+    ExitOnErr(RT->remove());
+    return value;
+}
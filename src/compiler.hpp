@@ -10,6 +10,7 @@
 #include <vector>
 #include <string>
 #include <map>
+#include <mutex>
 
 #include "codegen.hpp"
 #include "lex.hpp"
@@ -18,40 +19,42 @@
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/DerivedTypes.h"
 #include "llvm/IR/Module.h"
-#include "llvm/Analysis/LoopAnalysisManager.h"
-#include "llvm/Analysis/CGSCCPassManager.h"
-#include "llvm/Passes/StandardInstrumentations.h"
-#include "llvm/Passes/PassBuilder.h"
-#include "llvm/IR/PassManager.h"
-#include "llvm/Transforms/InstCombine/InstCombine.h"
-#include "llvm/Transforms/Scalar/Reassociate.h"
-#include "llvm/Transforms/Scalar/GVN.h"
-#include "llvm/Transforms/Scalar/SimplifyCFG.h"
+#include "llvm/Passes/OptimizationLevel.h"
 #include "llvm/ExecutionEngine/Orc/ThreadSafeModule.h"
 #include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/Threading.h"
 #include "ellis_jit.hpp"
+#include "emitter.hpp"
+#include "optimizer.hpp"
 
 using namespace llvm;
 
 
 class Compiler {
     bool verbose;
+    unsigned jobs = 0;
     std::unique_ptr<LLVMContext> TheContext;
     std::unique_ptr<IRBuilder<>> builder;
     std::unique_ptr<Module> module;
-    std::unique_ptr<std::map<std::string, AllocaInst *>> namedValues;
+    std::unique_ptr<NamedValueMap> namedValues;
     std::unique_ptr<CodeGenerator> codeGenerator;
     std::unique_ptr<EllisJIT> TheJIT;
-
-    std::unique_ptr<FunctionPassManager> TheFPM;
-    std::unique_ptr<LoopAnalysisManager> TheLAM;
-    std::unique_ptr<FunctionAnalysisManager> TheFAM;
-    std::unique_ptr<CGSCCAnalysisManager> TheCGAM;
-    std::unique_ptr<ModuleAnalysisManager> TheMAM;
-    std::unique_ptr<PassInstrumentationCallbacks> ThePIC;
-    std::unique_ptr<StandardInstrumentations> TheSI;
-    std::map<std::string, std::unique_ptr<PrototypeAST>> FunctionProtos;
+    std::unique_ptr<Optimizer> optimizer;
+    DeclarationTable declarations; // functions defined by earlier jit() calls and parallel compiles
+    std::mutex frontEnd; // guards the module being built and its generator
+    unsigned expressions = 0; // numbers each evaluation's entry point
     ExitOnError ExitOnErr;
+
+    void printSource(const std::string& file, std::string_view source) const;
+    int compileSerial(const std::vector<std::string>& files);
+    int compileParallel(const std::vector<std::string>& files, ThreadPoolStrategy strategy);
+    int compilePipelined(const std::string& file);
+
+    /// Has tier-ups report to the same timings and remarks as the compiler.
+    void shareReportsWithTiers() {
+        if (auto* tiers = TheJIT->getTiers())
+            tiers->getOptimizer().reportTo(*optimizer);
+    }
 public:
     void ReinitializeModuleAndManagers() {
         // Open a new context and module.
@@ -60,35 +63,11 @@ public:
         module->setDataLayout(TheJIT->getDataLayout());
         // Create a new builder for the module.
         builder = std::make_unique<IRBuilder<>>(*TheContext);
-        // Create new pass and analysis managers.
-        TheFPM = std::make_unique<FunctionPassManager>();
-        TheLAM = std::make_unique<LoopAnalysisManager>();
-        TheFAM = std::make_unique<FunctionAnalysisManager>();
-        TheCGAM = std::make_unique<CGSCCAnalysisManager>();
-        TheMAM = std::make_unique<ModuleAnalysisManager>();
-        ThePIC = std::make_unique<PassInstrumentationCallbacks>();
-        TheSI = std::make_unique<StandardInstrumentations>(false);
-        TheSI->registerCallbacks(*ThePIC, reinterpret_cast<FunctionAnalysisManager *>(TheMAM.get()));
-        // Add transform passes.
-        // Do simple "peephole" optimizations and bit-twiddling optzns.
-        TheFPM->addPass(InstCombinePass());
-        // Reassociate expressions.
-        TheFPM->addPass(ReassociatePass());
-        // Eliminate Common SubExpressions.
-        TheFPM->addPass(GVNHoistPass());
-        // Simplify the control flow graph (deleting unreachable blocks, etc).
-        TheFPM->addPass(SimplifyCFGPass());
-
-        // Register analysis passes used in these transform passes.
-        PassBuilder PB;
-        PB.registerModuleAnalyses(*TheMAM);
-        PB.registerFunctionAnalyses(*TheFAM);
-        PB.crossRegisterProxies(*TheLAM, *TheFAM, *TheCGAM, *TheMAM);
         std::cout << "Printing inside reinit:\n";
         for (auto p: *namedValues) {
-            std::cout << p.first << "\n";
+            std::cout << symbol_name(p.first) << "\n";
         }
-        codeGenerator = std::make_unique<CodeGenerator>(CodeGenerator(*TheContext, *builder, *module, namedValues.get()));
+        codeGenerator = std::make_unique<CodeGenerator>(CodeGenerator(*TheContext, *builder, *module, namedValues.get(), &declarations));
     }
 
     void InitializeModuleAndManagers() {
@@ -98,67 +77,112 @@ public:
         module->setDataLayout(TheJIT->getDataLayout());
         // Create a new builder for the module.
         builder = std::make_unique<IRBuilder<>>(*TheContext);
-        namedValues = std::make_unique<std::map<std::string, AllocaInst*>>();
-        // Create new pass and analysis managers.
-        TheFPM = std::make_unique<FunctionPassManager>();
-        TheLAM = std::make_unique<LoopAnalysisManager>();
-        TheFAM = std::make_unique<FunctionAnalysisManager>();
-        TheCGAM = std::make_unique<CGSCCAnalysisManager>();
-        TheMAM = std::make_unique<ModuleAnalysisManager>();
-        ThePIC = std::make_unique<PassInstrumentationCallbacks>();
-        TheSI = std::make_unique<StandardInstrumentations>(false);
-        TheSI->registerCallbacks(*ThePIC, reinterpret_cast<FunctionAnalysisManager *>(TheMAM.get()));
-        // Add transform passes.
-        // Do simple "peephole" optimizations and bit-twiddling optzns.
-        TheFPM->addPass(InstCombinePass());
-        // Reassociate expressions.
-        TheFPM->addPass(ReassociatePass());
-        // Eliminate Common SubExpressions.
-        TheFPM->addPass(GVNHoistPass());
-        // Simplify the control flow graph (deleting unreachable blocks, etc).
-        TheFPM->addPass(SimplifyCFGPass());
-
-        // Register analysis passes used in these transform passes.
-        PassBuilder PB;
-        PB.registerModuleAnalyses(*TheMAM);
-        PB.registerFunctionAnalyses(*TheFAM);
-        PB.crossRegisterProxies(*TheLAM, *TheFAM, *TheCGAM, *TheMAM);
-        codeGenerator = std::make_unique<CodeGenerator>(CodeGenerator(*TheContext, *builder, *module, namedValues.get()));
+        namedValues = std::make_unique<NamedValueMap>();
+        codeGenerator = std::make_unique<CodeGenerator>(CodeGenerator(*TheContext, *builder, *module, namedValues.get(), &declarations));
     }
 
-    explicit Compiler(const bool verbose) : verbose(verbose) {
+    /// Generates code at `level`; the JIT compiles it on up to `jitThreads`
+    /// threads (0: one per hardware thread).
+    explicit Compiler(const bool verbose, const OptimizationLevel level = OptimizationLevel::O2,
+                      const unsigned jitThreads = 0) : verbose(verbose) {
         InitializeNativeTarget();
         InitializeNativeTargetAsmPrinter();
         InitializeNativeTargetAsmParser();
-        TheJIT = ExitOnErr(EllisJIT::Create());
+        TheJIT = ExitOnErr(EllisJIT::Create(codegen_opt_level(level), jitThreads));
+        optimizer = std::make_unique<Optimizer>(level, TheJIT->getTargetMachineBuilder());
         InitializeModuleAndManagers();
     }
 
+    /// Number of threads compile() may use; 0 (the default) uses one per
+    /// hardware thread and 1 compiles everything on the calling thread.
+    void setJobs(const unsigned n) { jobs = n; }
+
+    /// Times each optimization pass, including those of tier-ups, for
+    /// reportTimings(); compile() reports at its end.
+    void timePasses() {
+        optimizer->timePasses();
+        shareReportsWithTiers();
+    }
+
+    /// Records which optimizations fired or were missed, including in
+    /// tier-ups, to a YAML file.
+    void writeRemarks(const std::string& path) {
+        optimizer->writeRemarks(path);
+        shareReportsWithTiers();
+    }
+
+    /// Prints the pass timings collected so far, if timePasses() was called.
+    void reportTimings() const {
+        if (const auto* timings = optimizer->getTimings())
+            timings->print(errs());
+    }
+
+    /// Generates and optimizes code for every file into one module. With
+    /// more than one job, several files are each parsed, generated and
+    /// optimized in a context of their own on worker threads and linked in
+    /// file order, while a single file is lexed, parsed and generated by
+    /// three pipelined threads.
     int compile(const std::vector<std::string>& files);
 
-    int jit(std::string& source) {
-        auto tokens = lex(std::move(source), false);
-        auto asts = parse(tokens);
-        auto Proto = std::make_unique<PrototypeAST>("__anon_expr",
-                                                    std::vector<std::string>());
-        auto anon_fn = FunctionAST(std::move(Proto), std::move(asts));
-        anon_fn.Accept(*codeGenerator);
-        anon_fn.getCode().v->print(errs());
-        printf("\n");
+    const Module& getModule() const { return *module; }
+
+    /// Writes the module compile() generated to `path` as `kind`, with native
+    /// code for the host. A `main` taking no arguments becomes the C entry
+    /// point (see add_entry_point()).
+    void emit(EmitKind kind, const std::string& path);
+
+    /// Compiles the module compile() generated for the host and links it
+    /// into the executable `path`.
+    void link(const std::string& path);
+
+    /// Runs code on the JIT: functions defined in `source` are kept for
+    /// later calls, and its other statements are evaluated right away. The
+    /// value of the last statement is returned.
+    ///
+    /// May be called from several threads at once: sources are parsed
+    /// concurrently, generated one at a time, and run concurrently. The
+    /// enable*() settings must be chosen before the first call.
+    double evaluate(std::string_view source);
+
+    /// Evaluates `source` and prints its value.
+    int jit(std::string_view source) {
+        fprintf(stderr, "Evaluated to %f\n", evaluate(source));
+        return 0;
+    }
 
-        auto RT = TheJIT->getMainJITDylib().createResourceTracker();
+    /// Compiles code run by jit() from now on in two tiers, recompiling
+    /// hot functions in the background (see TierManager).
+    void enableTiering(const TieringOptions& options) {
+        TheJIT->enableTiering(options);
+        shareReportsWithTiers();
+    }
 
-        auto TSM = llvm::orc::ThreadSafeModule(std::move(module), std::move(TheContext));
-        ExitOnErr(TheJIT->addModule(std::move(TSM), RT));
-        ReinitializeModuleAndManagers();
+    /// Compiles each function run by jit() from now on when it is first
+    /// called. Takes precedence over tiering.
+    void enableLazyCompilation() { ExitOnErr(TheJIT->enableLazyCompilation()); }
 
-        auto ExprSymbol = ExitOnErr(TheJIT->lookup("__anon_expr"));
-        auto *FP = jitTargetAddressToPointer<double (*)()>(ExprSymbol.getAddress());
+    /// Loads the machine code of unchanged modules from an on-disk cache
+    /// (see DiskObjectCache). A cache that cannot be used is reported and
+    /// left off.
+    void enableObjectCache(const ObjectCacheOptions& options) {
+        logAllUnhandledErrors(TheJIT->enableObjectCache(options), errs(), "warning: JIT object cache disabled: ");
+    }
 
-        fprintf(stderr, "Evaluated to %f\n", FP());
+    const DiskObjectCache& getObjectCache() const { return TheJIT->getObjectCache(); }
 
-        ExitOnErr(RT->remove());
-        return 0;
+    /// The tiers code run by jit() is compiled in, or nullptr without tiering.
+    const TierManager* getTiers() const { return TheJIT->getTiers(); }
+
+    /// Number of functions the JIT has compiled at the compiler's level.
+    unsigned compiledFunctions() const { return TheJIT->compiledFunctions(); }
+
+    /// Waits for pending tier-ups; returns how many functions were recompiled.
+    unsigned waitForTierUps() {
+        auto* tiers = TheJIT->getTiers();
+        if (!tiers)
+            return 0;
+        tiers->wait();
+        return tiers->promotions();
     }
 };
 
@@ -7,41 +7,98 @@
 
 #include "llvm/ADT/StringRef.h"
 #include "llvm/ExecutionEngine/JITSymbol.h"
+#include "llvm/ExecutionEngine/Orc/CompileOnDemandLayer.h"
 #include "llvm/ExecutionEngine/Orc/CompileUtils.h"
 #include "llvm/ExecutionEngine/Orc/Core.h"
 #include "llvm/ExecutionEngine/Orc/ExecutionUtils.h"
 #include "llvm/ExecutionEngine/Orc/ExecutorProcessControl.h"
 #include "llvm/ExecutionEngine/Orc/IRCompileLayer.h"
 #include "llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h"
+#include "llvm/ExecutionEngine/Orc/LazyReexports.h"
 #include "llvm/ExecutionEngine/Orc/RTDyldObjectLinkingLayer.h"
+#include "llvm/ExecutionEngine/Orc/TaskDispatch.h"
 #include "llvm/ExecutionEngine/SectionMemoryManager.h"
 #include "llvm/IR/DataLayout.h"
 #include "llvm/IR/LLVMContext.h"
+#include "llvm/MC/SubtargetFeature.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/ThreadPool.h"
+#include <atomic>
 #include <memory>
+#include <optional>
+
+#include "object_cache.hpp"
+#include "tiering.hpp"
 
 using namespace llvm;
 
+/// PooledTaskDispatcher - Runs the ExecutionSession's materialization tasks
+/// on a fixed pool of threads, so modules and lazily compiled functions that
+/// are looked up together compile in parallel. Unlike ORC's
+/// DynamicThreadPoolTaskDispatcher, which starts a thread per task, the
+/// number of compiler threads is bounded.
+class PooledTaskDispatcher : public llvm::orc::TaskDispatcher {
+    ThreadPool pool;
+public:
+    explicit PooledTaskDispatcher(const ThreadPoolStrategy strategy) : pool(strategy) {}
+
+    void dispatch(std::unique_ptr<llvm::orc::Task> T) override {
+        // ThreadPool tasks must be copyable.
+        std::shared_ptr<llvm::orc::Task> task = std::move(T);
+        pool.async([task] { task->run(); });
+    }
+
+    void shutdown() override { pool.wait(); }
+};
+
 class EllisJIT {
 private:
     std::unique_ptr<llvm::orc::ExecutionSession> ES;
     DataLayout DL;
+    llvm::orc::JITTargetMachineBuilder TargetBuilder;
+    DiskObjectCache Cache;
+    std::optional<ObjectCacheOptions> CacheOptions;
     llvm::orc::MangleAndInterner Mangle;
     llvm::orc::RTDyldObjectLinkingLayer ObjectLayer;
     llvm::orc::IRCompileLayer CompileLayer;
     llvm::orc::JITDylib &MainJD;
+    std::unique_ptr<TierManager> Tiers;
+    std::unique_ptr<llvm::orc::LazyCallThroughManager> LazyCalls;
+    std::unique_ptr<llvm::orc::CompileOnDemandLayer> LazyLayer;
+    std::atomic<unsigned> Compiled{0};
+
+    static bool onlyEntryPoints(const Module &M) {
+        return all_of(M.functions(), [](const Function &F) {
+            return F.isDeclaration() || F.getName().startswith("__");
+        });
+    }
+
+    static void lazyCompileFailed() {
+        errs() << "error: lazy compilation of a called function failed\n";
+        abort();
+    }
 
 public:
     EllisJIT(std::unique_ptr<llvm::orc::ExecutionSession> ES,
-             llvm::orc::JITTargetMachineBuilder JTMB, DataLayout DL)
-            : ES(std::move(ES)), DL(std::move(DL)), Mangle(*this->ES, this->DL),
+             llvm::orc::JITTargetMachineBuilder JTMB, DataLayout DL, CodeGenOpt::Level OptLevel)
+            : ES(std::move(ES)), DL(std::move(DL)), TargetBuilder(JTMB), Cache(JTMB, OptLevel),
+              Mangle(*this->ES, this->DL),
               ObjectLayer(*this->ES,
                           []() { return std::make_unique<SectionMemoryManager>(); }),
               CompileLayer(*this->ES, ObjectLayer,
-                           std::make_unique<llvm::orc::ConcurrentIRCompiler>(std::move(JTMB))),
+                           std::make_unique<llvm::orc::ConcurrentIRCompiler>(std::move(JTMB), &Cache)),
               MainJD(this->ES->createBareJITDylib("<main>")) {
         MainJD.addGenerator(
                 cantFail(llvm::orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(
                         DL.getGlobalPrefix())));
+        CompileLayer.setNotifyCompiled([this](llvm::orc::MaterializationResponsibility &,
+                                              llvm::orc::ThreadSafeModule TSM) {
+            TSM.withModuleDo([this](Module &M) {
+                for (auto &F : M)
+                    if (!F.isDeclaration())
+                        Compiled++;
+            });
+        });
         if (JTMB.getTargetTriple().isOSBinFormatCOFF()) {
             ObjectLayer.setOverrideObjectFlagsWithResponsibilityFlags(true);
             ObjectLayer.setAutoClaimResponsibilityForObjectSymbols(true);
@@ -49,12 +106,18 @@ public:
     }
 
     ~EllisJIT() {
+        if (Tiers)
+            Tiers->wait();
         if (auto Err = ES->endSession())
             ES->reportError(std::move(Err));
     }
 
-    static llvm::Expected<std::unique_ptr<EllisJIT>> Create() {
-        auto EPC = llvm::orc::SelfExecutorProcessControl::Create();
+    /// Creates a JIT for the host, generating machine code at `OptLevel` on
+    /// up to `Threads` threads (0: one per hardware thread).
+    static llvm::Expected<std::unique_ptr<EllisJIT>> Create(CodeGenOpt::Level OptLevel = CodeGenOpt::Default,
+                                                            unsigned Threads = 0) {
+        auto EPC = llvm::orc::SelfExecutorProcessControl::Create(
+                nullptr, std::make_unique<PooledTaskDispatcher>(hardware_concurrency(Threads)));
         if (!EPC)
             return EPC.takeError();
 
@@ -62,22 +125,83 @@ public:
 
         llvm::orc::JITTargetMachineBuilder JTMB(
                 ES->getExecutorProcessControl().getTargetTriple());
+        // The executor is this process, so tune for the CPU we run on.
+        JTMB.setCPU(sys::getHostCPUName().str());
+        SubtargetFeatures Features;
+        StringMap<bool> HostFeatures;
+        if (sys::getHostCPUFeatures(HostFeatures))
+            for (auto &Feature : HostFeatures)
+                Features.AddFeature(Feature.first(), Feature.second);
+        JTMB.addFeatures(Features.getFeatures());
+        JTMB.setCodeGenOptLevel(OptLevel);
 
         auto DL = JTMB.getDefaultDataLayoutForTarget();
         if (!DL)
             return DL.takeError();
 
         return std::make_unique<EllisJIT>(std::move(ES), std::move(JTMB),
-                                          std::move(*DL));
+                                          std::move(*DL), OptLevel);
     }
 
     const DataLayout &getDataLayout() const { return DL; }
 
+    /// Describes the target machine code is generated for.
+    const llvm::orc::JITTargetMachineBuilder &getTargetMachineBuilder() const { return TargetBuilder; }
+
     llvm::orc::JITDylib &getMainJITDylib() { return MainJD; }
 
+    /// Compiles modules added from now on in two tiers (see TierManager)
+    /// instead of once at the JIT's optimization level.
+    void enableTiering(const TieringOptions &Options) {
+        Tiers = std::make_unique<TierManager>(*ES, MainJD, Mangle, ObjectLayer, TargetBuilder, Options);
+        if (CacheOptions)
+            if (auto Err = Tiers->enableObjectCache(*CacheOptions))
+                ES->reportError(std::move(Err));
+    }
+
+    TierManager *getTiers() { return Tiers.get(); }
+
+    /// Compiles each function of modules added from now on only when it is
+    /// first called: until then its symbol is a lazy reexport whose stub
+    /// compiles the function's partition on the calling thread.
+    Error enableLazyCompilation() {
+        const auto &TT = TargetBuilder.getTargetTriple();
+        auto LCTM = llvm::orc::createLocalLazyCallThroughManager(
+                TT, *ES, pointerToJITTargetAddress(&EllisJIT::lazyCompileFailed));
+        if (!LCTM)
+            return LCTM.takeError();
+        LazyCalls = std::move(*LCTM);
+        LazyLayer = std::make_unique<llvm::orc::CompileOnDemandLayer>(
+                *ES, CompileLayer, *LazyCalls, llvm::orc::createLocalIndirectStubsManagerBuilder(TT));
+        LazyLayer->setPartitionFunction(llvm::orc::CompileOnDemandLayer::compileRequested);
+        return Error::success();
+    }
+
+    /// Keeps the machine code of the compile layer, and of both tiers when
+    /// tiering, on disk for later runs to load instead of compiling again.
+    Error enableObjectCache(const ObjectCacheOptions &Options) {
+        if (auto Err = Cache.open(Options))
+            return Err;
+        CacheOptions = Options;
+        if (Tiers)
+            return Tiers->enableObjectCache(Options);
+        return Error::success();
+    }
+
+    const DiskObjectCache &getObjectCache() const { return Cache; }
+
+    /// Number of function bodies compiled at the JIT's optimization level.
+    unsigned compiledFunctions() const { return Compiled; }
+
     Error addModule(llvm::orc::ThreadSafeModule TSM, llvm::orc::ResourceTrackerSP RT = nullptr) {
         if (!RT)
             RT = MainJD.getDefaultResourceTracker();
+        if (Tiers)
+            return Tiers->add(RT, std::move(TSM));
+        // Entry points ("__"-prefixed) run once, right away, and are compiled
+        // directly so that removing their tracker removes their code.
+        if (LazyLayer && !TSM.withModuleDo([](Module &M) { return onlyEntryPoints(M); }))
+            return LazyLayer->add(RT, std::move(TSM));
         return CompileLayer.add(RT, std::move(TSM));
     }
 
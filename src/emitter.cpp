@@ -0,0 +1,104 @@
+//
+// Created by jonathan on 10/17/26.
+//
+
+#include "emitter.hpp"
+#include "codegen.hpp"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Program.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetMachine.h"
+
+std::optional<EmitKind> emit_kind(const std::string_view name) {
+    if (name == "obj")
+        return EmitKind::object;
+    if (name == "asm")
+        return EmitKind::assembly;
+    if (name == "llvm-ir")
+        return EmitKind::llvm_ir;
+    if (name == "llvm-bc")
+        return EmitKind::llvm_bc;
+    return std::nullopt;
+}
+
+const char* emit_extension(const EmitKind kind) {
+    switch (kind) {
+        case EmitKind::object:
+            return ".o";
+        case EmitKind::assembly:
+            return ".s";
+        case EmitKind::llvm_ir:
+            return ".ll";
+        case EmitKind::llvm_bc:
+            return ".bc";
+    }
+    return "";
+}
+
+void add_entry_point(Module& module) {
+    auto* program = module.getFunction("main");
+    if (!program || program->isDeclaration() || program->arg_size() != 0 || !program->getReturnType()->isDoubleTy())
+        return;
+    program->setName("__ellis_main");
+
+    auto& context = module.getContext();
+    auto* entry = Function::Create(FunctionType::get(Type::getInt32Ty(context), false),
+                                   Function::ExternalLinkage, "main", module);
+    IRBuilder<> builder(BasicBlock::Create(context, "entry", entry));
+    builder.CreateRet(builder.CreateFPToSI(builder.CreateCall(program), builder.getInt32Ty()));
+    verifyFunction(*entry);
+}
+
+void emit(Module& module, const EmitKind kind, const std::string& path, orc::JITTargetMachineBuilder target) {
+    target.setRelocationModel(Reloc::PIC_);
+    auto machine = target.createTargetMachine();
+    if (!machine)
+        throw CodeGenerationException("Cannot generate code for " + target.getTargetTriple().str() + ": " +
+                                      toString(machine.takeError()));
+    module.setTargetTriple((*machine)->getTargetTriple().str());
+    module.setDataLayout((*machine)->createDataLayout());
+
+    std::error_code error;
+    raw_fd_ostream out(path, error, sys::fs::OF_None);
+    if (error)
+        throw CodeGenerationException("Cannot open " + path + ": " + error.message());
+
+    switch (kind) {
+        case EmitKind::llvm_ir:
+            module.print(out, nullptr);
+            break;
+        case EmitKind::llvm_bc:
+            WriteBitcodeToFile(module, out);
+            break;
+        case EmitKind::object:
+        case EmitKind::assembly: {
+            legacy::PassManager passes;
+            const auto type = kind == EmitKind::object ? CGFT_ObjectFile : CGFT_AssemblyFile;
+            if ((*machine)->addPassesToEmitFile(passes, out, nullptr, type))
+                throw CodeGenerationException("The target cannot emit a file of this type");
+            passes.run(module);
+            break;
+        }
+    }
+    out.close();
+    if (out.has_error()) {
+        const auto message = out.error().message();
+        out.clear_error();
+        throw CodeGenerationException("Cannot write " + path + ": " + message);
+    }
+}
+
+void link_executable(const std::string& object, const std::string& output) {
+    const auto driver = sys::findProgramByName("cc");
+    if (!driver)
+        throw CodeGenerationException("Cannot link " + output + ": no system C compiler (cc) found");
+    const StringRef args[] = {*driver, object, "-o", output, "-lm"};
+    std::string message;
+    const auto status = sys::ExecuteAndWait(*driver, args, None, {}, 0, 0, &message);
+    if (status != 0)
+        throw CodeGenerationException("Linking " + output + " failed" + (message.empty() ? "" : ": " + message));
+}
@@ -0,0 +1,47 @@
+//
+// Created by jonathan on 10/17/26.
+//
+
+#ifndef ELLIS_EMITTER_HPP
+#define ELLIS_EMITTER_HPP
+
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h"
+#include "llvm/IR/Module.h"
+
+/// EmitKind - What ahead-of-time compilation writes out.
+enum class EmitKind {
+    object,   // native object file
+    assembly, // native assembly
+    llvm_ir,  // textual LLVM IR
+    llvm_bc,  // LLVM bitcode
+};
+
+/// The kind named by an ellisc --emit value ("obj", "asm", "llvm-ir" or
+/// "llvm-bc").
+std::optional<EmitKind> emit_kind(std::string_view name);
+
+/// Conventional file extension of a kind, with the dot.
+const char* emit_extension(EmitKind kind);
+
+/// Turns the program's entry point, a `main` taking no arguments, into one
+/// the C runtime can call: it is renamed `__ellis_main` and called from an
+/// `int main()` that exits with its value. Modules without one are left
+/// alone.
+void add_entry_point(llvm::Module& module);
+
+/// Writes `module` to `path` as `kind`, generating native code for the target
+/// `target` describes. The code is position independent, so it links into
+/// the PIE executables system linkers make by default. Throws a
+/// CodeGenerationException if the file cannot be written.
+void emit(llvm::Module& module, EmitKind kind, const std::string& path, llvm::orc::JITTargetMachineBuilder target);
+
+/// Links the object file `object` into the executable `output` with the
+/// system C compiler driver (`cc`), against the C and math libraries. Throws
+/// a CodeGenerationException if linking fails.
+void link_executable(const std::string& object, const std::string& output);
+
+#endif //ELLIS_EMITTER_HPP
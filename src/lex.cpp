@@ -3,150 +3,229 @@
 //
 
 #include "lex.hpp"
+#include "lex_simd.hpp"
 
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cstring>
 #include <iostream>
-#include <set>
+#include <limits>
+#include <sstream>
+
+// Character classes, as bit flags, for every byte value. Bytes outside ASCII
+// have no class, so they fall through to the "not recognized" error.
+// Runs of whitespace, identifier and number characters are skipped by the
+// kernels in lex_simd.cpp instead.
+enum CharClass : std::uint8_t {
+    cc_alpha = 1 << 0,
+    cc_digit = 1 << 1,
+    cc_oper = 1 << 2,
+    cc_punct = 1 << 3,
+};
+
+constexpr std::array<std::uint8_t, 256> make_char_classes() {
+    std::array<std::uint8_t, 256> table = {};
+    for (int c = 'a'; c <= 'z'; c++)
+        table[c] |= cc_alpha;
+    for (int c = 'A'; c <= 'Z'; c++)
+        table[c] |= cc_alpha;
+    for (int c = '0'; c <= '9'; c++)
+        table[c] |= cc_digit;
+    for (const char c : std::string_view("+-/*%^&!=|<>"))
+        table[static_cast<unsigned char>(c)] |= cc_oper;
+    for (int c = 0; c < 256; c++)
+        if (punctuation_type(static_cast<char>(c)) != tok_eof)
+            table[c] |= cc_punct;
+    return table;
+}
 
-bool isoper(const char c) {
-    return operator_set.count(c) > 0;
+constexpr auto CHAR_CLASSES = make_char_classes();
+
+constexpr bool has_class(const char c, const std::uint8_t cls) {
+    return (CHAR_CLASSES[static_cast<unsigned char>(c)] & cls) != 0;
 }
 
+static_assert(has_class('z', cc_alpha) && !has_class('_', cc_alpha));
+static_assert(has_class('=', cc_oper) && has_class(';', cc_punct));
+static_assert(keyword_type("return") == tok_return && keyword_type("returns") == tok_identifier);
+
+bool isoper(const char c) {
+    return has_class(c, cc_oper);
+}
 
-Token get_token_type(const std::string& s) {
-    if (TOKEN_MAP.count(s))
-        return TOKEN_MAP.at(s);
 
-    if (isalpha(s[0]))
-        return tok_identifier;
 
-    if (isdigit(s[0]))
-        return tok_number;
+// Each lex_* function below starts at source[pos], advances pos past what it
+// consumed and returns the token as a view; nothing is erased or copied.
 
-    throw std::invalid_argument("Token not recognized, when trying to retrieve type: " + s);
+TokenView make_token(const Token kind, const std::size_t begin, const std::size_t end) {
+    if (end - begin > TokenView::max_length)
+        throw std::invalid_argument("Token too long: " + std::to_string(end - begin) + " bytes");
+    return TokenView::make(kind, static_cast<std::uint32_t>(begin), static_cast<std::uint32_t>(end - begin));
 }
 
+TokenView lex_alphanum(std::string_view source, std::size_t& pos) {
+    const auto begin = pos;
+    pos = skip_identifier(source, pos);
+    const auto text = source.substr(begin, pos - begin);
+    return make_token(keyword_type(text), begin, pos);
+}
 
-TokenPair lex_alphanum(std::string& source) {
-    std::string alphanum = "";
-    auto tp = TokenPair();
-    if (!source.empty()) {
-        for (const auto c : source) {
-            if (isalnum(c) || c == '_') {
-                alphanum += c;
-            } else break;
-        }
-    }
-    source.erase(0, alphanum.length());
-    tp.second = alphanum;
-    tp.first = get_token_type(alphanum);
-    return tp;
-}
-
-TokenPair lex_operator(std::string& source) {
-    std::string op;
-    auto tp = TokenPair();
-    if (!source.empty()) {
-        for (const auto c : source) {
-            if (isoper(c)) {
-                op += c;
-            } else break;
-        }
-    }
-    source.erase(0, op.length());
-    tp.second = op;
-    tp.first = tok_operator;
-    return tp;
+TokenView lex_operator(std::string_view source, std::size_t& pos, OperatorKind& op) {
+    const auto begin = pos;
+    while (pos < source.size() && isoper(source[pos]))
+        pos++;
+    op = operator_type(source.substr(begin, pos - begin));
+    return make_token(tok_operator, begin, pos);
 }
 
-TokenPair lex_string_literal(std::string& source) {
-    std::string str;
-    auto tp = TokenPair();
+TokenView lex_string_literal(std::string_view source, std::size_t& pos) {
+    const auto begin = ++pos; // skip initial double quote
     bool escaped = false;
-    source.erase(0, 1); // remove initial double quote
-    bool finished = false;
-    for (const auto c : source) {
+    for (; pos < source.size(); pos++) {
+        const auto c = source[pos];
         if (c == '"' && !escaped) {
-            finished = true;
-            break;
+            auto tv = make_token(tok_string_literal, begin, pos);
+            pos++; // skip closing double quote
+            return tv;
         }
-
-        if (c == '\\') {
-            escaped = true;
-            str += c;
-        } else {
-            escaped = false;
-            str += c;
-        }
-    }
-
-    if (!finished) {
-        throw std::invalid_argument("String literal not terminated");
+        escaped = c == '\\';
     }
-
-    source.erase(0, str.length() + 1);
-    tp.second = str;
-    tp.first = tok_string_literal;
-    return tp;
+    throw std::invalid_argument("String literal not terminated");
 }
 
-TokenPair lex_char_literal(std::string& source) {
-    std::string str;
-    auto tp = TokenPair();
+TokenView lex_char_literal(std::string_view source, std::size_t& pos) {
+    const auto begin = ++pos; // skip initial single quote
     bool escaped = false;
-    bool finished = false;
-    source.erase(0, 1); // remove initial single quote
     int char_length = 0;
-    for (const auto c : source) {
+    for (; pos < source.size(); pos++) {
+        const auto c = source[pos];
         if (c == '\'' && !escaped) {
-            finished = true;
-            break;
+            if (char_length > 1) {
+                throw std::invalid_argument("Multi-character literal found");
+            }
+            auto tv = make_token(tok_char_literal, begin, pos);
+            pos++; // skip closing single quote
+            return tv;
         }
-
-        if (c == '\\') {
-            escaped = true;
-            str += c;
-        } else {
-            escaped = false;
-            str += c;
+        escaped = c == '\\';
+        if (!escaped)
             char_length++;
-        }
     }
+    throw std::invalid_argument("String literal not terminated");
+}
 
-    if (!finished) {
-        throw std::invalid_argument("String literal not terminated");
+// Copies the digits of a literal without its '_' separators into a fixed
+// buffer so they can be handed to std::from_chars without allocating.
+template<std::size_t N>
+std::size_t strip_separators(std::string_view digits, std::array<char, N>& buffer) {
+    std::size_t n = 0;
+    for (const auto c : digits) {
+        if (c == '_')
+            continue;
+        if (n == N)
+            throw std::invalid_argument("Numeric literal too long: " + std::string(digits));
+        buffer[n++] = c;
     }
+    return n;
+}
 
-    if (char_length > 1) {
-        throw std::invalid_argument("Multi-character literal found");
-    }
+std::int64_t parse_integer(std::string_view digits, const int base, std::string_view literal) {
+    std::array<char, 80> buffer;
+    const auto n = strip_separators(digits, buffer);
+    std::int64_t result = 0;
+    const auto [end, ec] = std::from_chars(buffer.data(), buffer.data() + n, result, base);
+    if (ec == std::errc::result_out_of_range)
+        throw std::invalid_argument("Integer literal out of range: " + std::string(literal));
+    if (ec != std::errc() || end != buffer.data() + n)
+        throw std::invalid_argument("Invalid numeric literal: " + std::string(literal));
+    return result;
+}
+
+double parse_float(std::string_view literal) {
+    std::array<char, 400> buffer;
+    const auto n = strip_separators(literal, buffer);
+    double result = 0;
+    const auto [end, ec] = std::from_chars(buffer.data(), buffer.data() + n, result);
+    if (ec == std::errc::result_out_of_range)
+        throw std::invalid_argument("Float literal out of range: " + std::string(literal));
+    if (ec != std::errc() || end != buffer.data() + n)
+        throw std::invalid_argument("Invalid numeric literal: " + std::string(literal));
+    return result;
+}
 
-    source.erase(0, str.length() + 1);
-    tp.second = str;
-    tp.first = tok_char_literal;
-    return tp;
+bool is_digit_at(std::string_view source, const std::size_t pos) {
+    return pos < source.size() && has_class(source[pos], cc_digit);
 }
 
-TokenPair lex_number(std::string& source) {
-    std::string num;
-    auto tp = TokenPair();
-    for (auto c: source) {
-        // TODO: Add support for floats
-        if (isdigit(c) || c == '.')
-            num += c;
-        else break;
+// Number literals:
+//   integer:  1234, 1_000_000, 0x7f_ff, 0b1010
+//   float:    3.25, 1e-9, 6.022_140e23   (a '.' must be followed by a digit)
+// The value is converted here, once, and returned through `value`.
+TokenView lex_number(std::string_view source, std::size_t& pos, NumberValue& value) {
+    const auto begin = pos;
+    const auto prefix = pos + 1 < source.size() && source[pos] == '0' ? source[pos + 1] | 0x20 : 0;
+    Token kind = tok_integer;
+
+    if (prefix == 'x' || prefix == 'b') {
+        pos += 2;
+        const auto digits_begin = pos;
+        pos = skip_identifier(source, pos); // hex digits, binary digits and '_'
+        const auto literal = source.substr(begin, pos - begin);
+        value.integer = parse_integer(source.substr(digits_begin, pos - digits_begin),
+                                      prefix == 'x' ? 16 : 2, literal);
+        return make_token(kind, begin, pos);
+    }
 
+    pos = skip_number(source, pos);
+    if (pos + 1 < source.size() && source[pos] == '.' && is_digit_at(source, pos + 1)) {
+        kind = tok_float;
+        pos = skip_number(source, pos + 1);
     }
-    tp.first = tok_number;
-    tp.second = num;
-    source.erase(0, num.length());
-    return tp;
+    if (pos < source.size() && (source[pos] | 0x20) == 'e') {
+        const auto sign = pos + 1 < source.size() && (source[pos + 1] == '+' || source[pos + 1] == '-');
+        if (is_digit_at(source, pos + 1 + sign)) {
+            kind = tok_float;
+            pos = skip_number(source, pos + 1 + sign);
+        }
+    }
+
+    const auto literal = source.substr(begin, pos - begin);
+    // Reject things like 12abc or 1_000x: a literal may not run into a name.
+    if (pos < source.size() && (has_class(source[pos], cc_alpha) || source[pos] == '_'))
+        throw std::invalid_argument("Invalid numeric literal: " + std::string(source.substr(begin, pos - begin + 1)));
+
+    if (kind == tok_float)
+        value.floating = parse_float(literal);
+    else
+        value.integer = parse_integer(literal, 10, literal);
+    return make_token(kind, begin, pos);
 }
 
+Token get_token_type(std::string_view s) {
+    if (s.empty())
+        throw std::invalid_argument("Token not recognized, when trying to retrieve type: empty token");
+
+    if (has_class(s[0], cc_alpha))
+        return keyword_type(s);
 
+    if (s.size() == 1 && has_class(s[0], cc_punct))
+        return punctuation_type(s[0]);
+
+    if (has_class(s[0], cc_digit)) {
+        std::size_t pos = 0;
+        NumberValue value;
+        return lex_number(s, pos, value).kind();
+    }
 
-void lex_comment(std::string& source) {
-    auto pos = source.find_first_of("\n");
-    source.erase(0, pos);
+    throw std::invalid_argument("Token not recognized, when trying to retrieve type: " + std::string(s));
+}
+
+void lex_comment(std::string_view source, std::size_t& pos) {
+    // find() bottoms out in memchr, which libc already vectorizes.
+    const auto nl = source.find('\n', pos);
+    pos = nl == std::string_view::npos ? source.size() : nl;
 }
 
 void print_token(const TokenPair& tp) {
@@ -154,38 +233,87 @@ void print_token(const TokenPair& tp) {
 }
 
 
-std::vector<TokenPair> lex(std::string source, bool verbose=false) {
-    auto tokens = std::vector<TokenPair>();
-    while (!source.empty()) {
-        //  strip all whitespace
-        auto ws = source.find_first_not_of(" \t\n\v\f\r");
-        source.erase(0, ws);
-        source.erase(source.find_last_not_of(" \n\r\t")+1);
-
-        if (isalpha(source[0])) {
-            tokens.push_back(lex_alphanum(source));
-        } else if (isdigit(source[0])) {
-            tokens.push_back(lex_number(source));
-        } else if (isoper(source[0])) {
-            tokens.push_back(lex_operator(source));
-        } else if (source[0] == '"') {
-            tokens.push_back(lex_string_literal(source));
-        } else if (source[0] == '\'') {
-            tokens.push_back(lex_char_literal(source));
-        }
-        else if (TOKEN_MAP.count(std::string(1, source[0]))) {
-            std::string t(1, source[0]);
-            TokenPair tp = {get_token_type(t), t};
-            tokens.push_back(tp);
-            source.erase(0, t.size());
-        } else if (source[0] == '#') {
-            lex_comment(source);
+std::ostream& operator<<(std::ostream& os, const SourceLocation& loc) {
+    return os << loc.line << ":" << loc.column;
+}
+
+LineTable::LineTable(std::string_view source) {
+    starts.push_back(0);
+    for (const char* p = source.data(), *end = p + source.size();
+         (p = static_cast<const char*>(std::memchr(p, '\n', end - p))) != nullptr; p++) {
+        starts.push_back(static_cast<std::uint32_t>(p - source.data() + 1));
+    }
+}
+
+SourceLocation LineTable::locate(const std::uint32_t offset) const {
+    // Last line starting at or before offset.
+    const auto line = std::upper_bound(starts.begin(), starts.end(), offset) - starts.begin();
+    return {static_cast<std::uint32_t>(line), offset - starts[line - 1] + 1};
+}
+
+Lexer::Lexer(std::string_view source, const std::size_t begin) : source(source), pos(begin) {
+    if (source.size() > std::numeric_limits<std::uint32_t>::max())
+        throw std::invalid_argument("Source too large to lex: " + std::to_string(source.size()) + " bytes");
+    if (begin > source.size())
+        throw std::out_of_range("Lexer start past end of source");
+}
+
+TokenView Lexer::next() {
+    while (true) {
+        //  skip whitespace
+        pos = skip_whitespace(source, pos);
+        if (pos == source.size())
+            return make_token(tok_eof, pos, pos);
+
+        const auto c = source[pos];
+        if (has_class(c, cc_alpha)) {
+            return lex_alphanum(source, pos);
+        } else if (has_class(c, cc_digit)) {
+            return lex_number(source, pos, value);
+        } else if (isoper(c)) {
+            return lex_operator(source, pos, oper);
+        } else if (c == '"') {
+            return lex_string_literal(source, pos);
+        } else if (c == '\'') {
+            return lex_char_literal(source, pos);
+        } else if (has_class(c, cc_punct)) {
+            pos++;
+            return make_token(punctuation_type(c), pos - 1, pos);
+        } else if (c == '#') {
+            lex_comment(source, pos);
         }
 
         else {
-            throw std::invalid_argument("Token not recognized while lexing: " + std::string(1, source[0]));
+            std::stringstream ss;
+            ss << locate(pos) << ": Token not recognized while lexing: " << c;
+            throw std::invalid_argument(ss.str());
         }
     }
+}
+
+SourceLocation Lexer::locate(const std::uint32_t offset) const {
+    if (!lines)
+        lines = std::make_unique<LineTable>(source);
+    return lines->locate(offset);
+}
+
+std::vector<TokenView> scan(std::string_view source) {
+    auto lexer = Lexer(source);
+    auto tokens = std::vector<TokenView>();
+    for (auto t = lexer.next(); t.kind() != tok_eof; t = lexer.next()) {
+        tokens.push_back(t);
+    }
+    return tokens;
+}
+
+
+std::vector<TokenPair> lex(std::string_view source, bool verbose=false) {
+    const auto views = scan(source);
+    auto tokens = std::vector<TokenPair>();
+    tokens.reserve(views.size());
+    for (const auto& t : views) {
+        tokens.emplace_back(t.kind(), std::string(token_text(source, t)));
+    }
 
     if (verbose) {
         for (auto& t : tokens) {
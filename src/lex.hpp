@@ -4,12 +4,19 @@
 
 #ifndef ELLIS_LEX_HPP
 #define ELLIS_LEX_HPP
+#include <cstdint>
 #include <map>
+#include <memory>
+#include <ostream>
 #include <set>
 #include <stdexcept>
 #include <string>
+#include <string_view>
 #include <vector>
 
+#include "operators.hpp"
+#include "symbol.hpp"
+
 enum Token {
     tok_eof = -1,
     tok_let = 1,
@@ -45,29 +52,55 @@ enum Token {
     tok_operator = 34,
 
     tok_identifier = -4,
-    tok_number = -5
+    tok_integer = -5,
+    tok_float = -6
 };
 
-const std::map<std::string, Token> TOKEN_MAP = {
-    {"let",tok_let},
-    {"if",tok_if},
-    {"else",tok_else},
-    {"for",tok_for},
-    {"while",tok_while},
-    {"end", tok_end},
-    {"(", tok_lparen},
-    {")", tok_rparen},
-    {";", tok_semicolon},
-    {"\"", tok_double_quote},
-    {"'", tok_single_quote},
-    {"then", tok_then},
-    {"in", tok_in},
-    {"or", tok_log_op},
-    {"and", tok_log_op},
-    {"not", tok_not},
-    {"return", tok_return},
-    {".", tok_period}
-};
+/// Classifies a reserved word, or returns tok_identifier if `s` is not one.
+/// Dispatches on length first so each candidate costs at most a couple of
+/// short compares; usable in constant expressions.
+constexpr Token keyword_type(const std::string_view s) {
+    switch (s.size()) {
+        case 2:
+            if (s == "if") return tok_if;
+            if (s == "in") return tok_in;
+            if (s == "or") return tok_log_op;
+            break;
+        case 3:
+            if (s == "let") return tok_let;
+            if (s == "for") return tok_for;
+            if (s == "end") return tok_end;
+            if (s == "and") return tok_log_op;
+            if (s == "not") return tok_not;
+            break;
+        case 4:
+            if (s == "else") return tok_else;
+            if (s == "then") return tok_then;
+            break;
+        case 5:
+            if (s == "while") return tok_while;
+            break;
+        case 6:
+            if (s == "return") return tok_return;
+            break;
+        default:
+            break;
+    }
+    return tok_identifier;
+}
+
+/// Single-character punctuation tokens; tok_eof if `c` is not one of them.
+constexpr Token punctuation_type(const char c) {
+    switch (c) {
+        case '(': return tok_lparen;
+        case ')': return tok_rparen;
+        case ';': return tok_semicolon;
+        case '"': return tok_double_quote;
+        case '\'': return tok_single_quote;
+        case '.': return tok_period;
+        default: return tok_eof;
+    }
+}
 
 const std::map<Token, std::string> TOKEN_STRINGS = {
     {tok_let, "LET"},
@@ -83,7 +116,8 @@ const std::map<Token, std::string> TOKEN_STRINGS = {
     {tok_double_quote, "\""},
     {tok_single_quote, "'"},
     {tok_identifier, "IDENTIFIER"},
-    {tok_number, "NUMBER"},
+    {tok_integer, "INTEGER"},
+    {tok_float, "FLOAT"},
     {tok_string_literal, "STRING_LITERAL"},
     {tok_char_literal, "CHAR_LITERAL"},
     {tok_then, "THEN"},
@@ -93,21 +127,6 @@ const std::map<Token, std::string> TOKEN_STRINGS = {
     {tok_period, "."}
 };
 
-const std::set operator_set = {
-    '+',
-    '-',
-    '/',
-    '*',
-    '%',
-    '^',
-    '&',
-    '!',
-    '=',
-    '|',
-    '<',
-    '>',
-};
-
 const std::set infix_operators = {
     "+",
     "-",
@@ -136,8 +155,93 @@ const std::set infix_operators = {
 
 typedef std::pair<Token, std::string> TokenPair;
 
-Token get_token_type(const std::string& s);
-std::vector<TokenPair> lex(std::string source, bool verbose);
+/// TokenView - A token packed into 8 bytes: a 32-bit offset into the source
+/// buffer it was scanned from, then a 1-byte kind and a 24-bit length. No
+/// text is copied; use token_text() to get the spelling back. For string and
+/// char literals the window covers the contents between the quotes.
+struct TokenView {
+    static constexpr std::uint32_t max_length = (1u << 24) - 1;
+
+    std::uint32_t offset;
+    std::uint32_t kind_and_length;
+
+    static TokenView make(const Token kind, const std::uint32_t offset, const std::uint32_t length) {
+        return {offset, (length << 8) | static_cast<std::uint8_t>(kind)};
+    }
+
+    Token kind() const { return static_cast<Token>(static_cast<std::int8_t>(kind_and_length & 0xFF)); }
+    std::uint32_t length() const { return kind_and_length >> 8; }
+};
+
+static_assert(sizeof(TokenView) == 8, "TokenView should stay packed");
+
+/// NumberValue - Value of an integer (tok_integer) or floating (tok_float)
+/// literal, converted once while lexing.
+union NumberValue {
+    std::int64_t integer;
+    double floating;
+};
+
+Token get_token_type(std::string_view s);
+
+inline std::string_view token_text(std::string_view source, const TokenView& t) {
+    return source.substr(t.offset, t.length());
+}
+
+/// 1-based line and column of a byte offset.
+struct SourceLocation {
+    std::uint32_t line;
+    std::uint32_t column;
+};
+
+std::ostream& operator<<(std::ostream& os, const SourceLocation& loc);
+
+/// LineTable - Offsets at which each line of a source buffer starts. Tokens
+/// only carry byte offsets; this is built the first time a location is
+/// actually needed (i.e. for a diagnostic) and turns an offset into a line
+/// and column with a binary search.
+class LineTable {
+    std::vector<std::uint32_t> starts;
+public:
+    explicit LineTable(std::string_view source);
+    SourceLocation locate(std::uint32_t offset) const;
+};
+
+/// Lexer - Pull-based scanner over a source buffer that must outlive it.
+/// Each call to next() scans exactly one more token, so tokens are produced
+/// on demand rather than materialized up front.
+class Lexer {
+    std::string_view source;
+    std::size_t pos = 0;
+    NumberValue value = {};
+    OperatorKind oper = OperatorKind::none;
+    mutable std::unique_ptr<LineTable> lines;
+public:
+    /// Scans source[begin, source.size()); token offsets and locations stay
+    /// relative to the start of `source`, so a chunk of a file can be lexed
+    /// on its own by passing the file up to the chunk's end.
+    explicit Lexer(std::string_view source, std::size_t begin = 0);
+
+    /// Scans the next token; returns tok_eof (repeatedly) at end of input.
+    TokenView next();
+
+    /// Value of the token last returned by next(), if it was a number.
+    const NumberValue& literal() const { return value; }
+
+    /// Operator classified for the token last returned by next(), if it was
+    /// a tok_operator (OperatorKind::none for an unknown spelling).
+    OperatorKind op() const { return oper; }
+
+    std::string_view text(const TokenView& t) const { return token_text(source, t); }
+    std::string_view getSource() const { return source; }
+    SourceLocation locate(std::uint32_t offset) const;
+};
+
+/// Scans the whole of `source` in a single forward pass.
+std::vector<TokenView> scan(std::string_view source);
+
+/// Adapter over scan() that copies each token's spelling out into a TokenPair.
+std::vector<TokenPair> lex(std::string_view source, bool verbose);
 
 
 #endif //ELLIS_LEX_HPP
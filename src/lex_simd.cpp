@@ -0,0 +1,237 @@
+//
+// Created by jonathan on 10/17/26.
+//
+
+#include "lex_simd.hpp"
+
+#include <atomic>
+#include <cstdint>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define ELLIS_SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+namespace {
+
+// Scalar reference versions; the vector kernels must agree with these.
+
+inline bool in_range(const unsigned char c, const char lo, const char hi) {
+    return static_cast<unsigned char>(c - lo) <= static_cast<unsigned char>(hi - lo);
+}
+
+inline bool is_space(const unsigned char c) {
+    return c == ' ' || in_range(c, '\t', '\r');
+}
+
+inline bool is_ident(const unsigned char c) {
+    return in_range(c | 0x20, 'a', 'z') || in_range(c, '0', '9') || c == '_';
+}
+
+inline bool is_number(const unsigned char c) {
+    return in_range(c, '0', '9') || c == '_';
+}
+
+template<bool (*InRun)(unsigned char)>
+std::size_t skip_scalar(std::string_view s, std::size_t pos) {
+    while (pos < s.size() && InRun(static_cast<unsigned char>(s[pos])))
+        pos++;
+    return pos;
+}
+
+#ifdef ELLIS_SCAN_X86
+
+// Vector class tests. Byte ranges use the unsigned trick (x - lo) <= (hi - lo),
+// computed as min_epu8(x - lo, hi - lo) == x - lo.
+
+inline __m128i in_range_128(const __m128i v, const char lo, const char hi) {
+    const auto d = _mm_sub_epi8(v, _mm_set1_epi8(lo));
+    return _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(static_cast<char>(hi - lo))), d);
+}
+
+inline __m128i space_128(const __m128i v) {
+    return _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), in_range_128(v, '\t', '\r'));
+}
+
+inline __m128i ident_128(const __m128i v) {
+    const auto alpha = in_range_128(_mm_or_si128(v, _mm_set1_epi8(0x20)), 'a', 'z');
+    const auto digit = in_range_128(v, '0', '9');
+    return _mm_or_si128(_mm_or_si128(alpha, digit), _mm_cmpeq_epi8(v, _mm_set1_epi8('_')));
+}
+
+inline __m128i number_128(const __m128i v) {
+    return _mm_or_si128(in_range_128(v, '0', '9'), _mm_cmpeq_epi8(v, _mm_set1_epi8('_')));
+}
+
+template<__m128i (*InRun)(__m128i), bool (*InRunScalar)(unsigned char)>
+std::size_t skip_sse2(std::string_view s, std::size_t pos) {
+    // Most runs are a byte or two long (a single space, a short name), so
+    // don't pay for a vector load until the run has lasted past one byte.
+    if (pos >= s.size() || !InRunScalar(static_cast<unsigned char>(s[pos])))
+        return pos;
+    pos++;
+    const char* data = s.data();
+    while (pos + 16 <= s.size()) {
+        const auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + pos));
+        const auto outside = ~static_cast<unsigned>(_mm_movemask_epi8(InRun(v))) & 0xFFFFu;
+        if (outside)
+            return pos + __builtin_ctz(outside);
+        pos += 16;
+    }
+    return skip_scalar<InRunScalar>(s, pos);
+}
+
+__attribute__((target("avx2")))
+inline __m256i in_range_256(const __m256i v, const char lo, const char hi) {
+    const auto d = _mm256_sub_epi8(v, _mm256_set1_epi8(lo));
+    return _mm256_cmpeq_epi8(_mm256_min_epu8(d, _mm256_set1_epi8(static_cast<char>(hi - lo))), d);
+}
+
+__attribute__((target("avx2")))
+inline __m256i space_256(const __m256i v) {
+    return _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')), in_range_256(v, '\t', '\r'));
+}
+
+__attribute__((target("avx2")))
+inline __m256i ident_256(const __m256i v) {
+    const auto alpha = in_range_256(_mm256_or_si256(v, _mm256_set1_epi8(0x20)), 'a', 'z');
+    const auto digit = in_range_256(v, '0', '9');
+    return _mm256_or_si256(_mm256_or_si256(alpha, digit), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('_')));
+}
+
+__attribute__((target("avx2")))
+inline __m256i number_256(const __m256i v) {
+    return _mm256_or_si256(in_range_256(v, '0', '9'), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('_')));
+}
+
+template<__m256i (*InRun)(__m256i), __m128i (*InRun128)(__m128i), bool (*InRunScalar)(unsigned char)>
+__attribute__((target("avx2")))
+std::size_t skip_avx2(std::string_view s, std::size_t pos) {
+    if (pos >= s.size() || !InRunScalar(static_cast<unsigned char>(s[pos])))
+        return pos;
+    pos++;
+    const char* data = s.data();
+    // Same reasoning one size up: one 16-byte block ends nearly every run, only
+    // long runs (deep indentation, generated names) reach the 32-byte loop.
+    if (pos + 16 <= s.size()) {
+        const auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + pos));
+        const auto outside = ~static_cast<unsigned>(_mm_movemask_epi8(InRun128(v))) & 0xFFFFu;
+        if (outside)
+            return pos + __builtin_ctz(outside);
+        pos += 16;
+    }
+    while (pos + 32 <= s.size()) {
+        const auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + pos));
+        const auto outside = ~static_cast<unsigned>(_mm256_movemask_epi8(InRun(v)));
+        if (outside)
+            return pos + __builtin_ctz(outside);
+        pos += 32;
+    }
+    return skip_sse2<InRun128, InRunScalar>(s, pos);
+}
+
+#endif // ELLIS_SCAN_X86
+
+struct ScanKernels {
+    ScanIsa isa;
+    std::size_t (*whitespace)(std::string_view, std::size_t);
+    std::size_t (*identifier)(std::string_view, std::size_t);
+    std::size_t (*number)(std::string_view, std::size_t);
+};
+
+const ScanKernels scalar_kernels = {
+    ScanIsa::scalar,
+    skip_scalar<is_space>,
+    skip_scalar<is_ident>,
+    skip_scalar<is_number>,
+};
+
+#ifdef ELLIS_SCAN_X86
+const ScanKernels sse2_kernels = {
+    ScanIsa::sse2,
+    skip_sse2<space_128, is_space>,
+    skip_sse2<ident_128, is_ident>,
+    skip_sse2<number_128, is_number>,
+};
+
+const ScanKernels avx2_kernels = {
+    ScanIsa::avx2,
+    skip_avx2<space_256, space_128, is_space>,
+    skip_avx2<ident_256, ident_128, is_ident>,
+    skip_avx2<number_256, number_128, is_number>,
+};
+#endif
+
+const ScanKernels& kernels_for(const ScanIsa isa) {
+    switch (isa) {
+#ifdef ELLIS_SCAN_X86
+        case ScanIsa::avx2:
+            return avx2_kernels;
+        case ScanIsa::sse2:
+            return sse2_kernels;
+#endif
+        default:
+            return scalar_kernels;
+    }
+}
+
+std::atomic<const ScanKernels*> active_kernels{nullptr};
+
+const ScanKernels& kernels() {
+    auto k = active_kernels.load(std::memory_order_relaxed);
+    if (!k) {
+        // Default to at most SSE2: nearly all runs end within 16 bytes, and
+        // lex_bench measures AVX2 slightly behind SSE2 on generated sources.
+        const auto best = detect_scan_isa();
+        k = &kernels_for(best > ScanIsa::sse2 ? ScanIsa::sse2 : best);
+        active_kernels.store(k, std::memory_order_relaxed);
+    }
+    return *k;
+}
+
+} // namespace
+
+ScanIsa detect_scan_isa() {
+#ifdef ELLIS_SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return ScanIsa::avx2;
+    if (__builtin_cpu_supports("sse2"))
+        return ScanIsa::sse2;
+#endif
+    return ScanIsa::scalar;
+}
+
+ScanIsa get_scan_isa() {
+    return kernels().isa;
+}
+
+ScanIsa set_scan_isa(const ScanIsa isa) {
+    const auto best = detect_scan_isa();
+    const auto& k = kernels_for(isa > best ? best : isa);
+    active_kernels.store(&k, std::memory_order_relaxed);
+    return k.isa;
+}
+
+const char* scan_isa_name(const ScanIsa isa) {
+    switch (isa) {
+        case ScanIsa::avx2:
+            return "avx2";
+        case ScanIsa::sse2:
+            return "sse2";
+        default:
+            return "scalar";
+    }
+}
+
+std::size_t skip_whitespace(std::string_view s, std::size_t pos) {
+    return kernels().whitespace(s, pos);
+}
+
+std::size_t skip_identifier(std::string_view s, std::size_t pos) {
+    return kernels().identifier(s, pos);
+}
+
+std::size_t skip_number(std::string_view s, std::size_t pos) {
+    return kernels().number(s, pos);
+}
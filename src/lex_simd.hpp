@@ -0,0 +1,37 @@
+//
+// Created by jonathan on 10/17/26.
+//
+
+#ifndef ELLIS_LEX_SIMD_HPP
+#define ELLIS_LEX_SIMD_HPP
+
+#include <cstddef>
+#include <string_view>
+
+/// Instruction set used by the run-skipping kernels below, chosen at runtime
+/// from what the CPU supports (SSE2 by default where available, see
+/// lex_simd.cpp). set_scan_isa() overrides it, which is what bench/lex_bench
+/// uses to compare the kernels against the scalar loops.
+enum class ScanIsa {
+    scalar,
+    sse2,
+    avx2,
+};
+
+ScanIsa detect_scan_isa();
+ScanIsa get_scan_isa();
+/// Selects `isa`, or the best supported one below it; returns what was chosen.
+ScanIsa set_scan_isa(ScanIsa isa);
+const char* scan_isa_name(ScanIsa isa);
+
+// Each kernel returns the index of the first byte at or after `pos` that is
+// not part of the run, or s.size() if the run reaches the end of input.
+
+/// Whitespace: ' ', '\t', '\n', '\v', '\f', '\r'.
+std::size_t skip_whitespace(std::string_view s, std::size_t pos);
+/// Identifier continuation: [A-Za-z0-9_].
+std::size_t skip_identifier(std::string_view s, std::size_t pos);
+/// Decimal digits with separators: [0-9_].
+std::size_t skip_number(std::string_view s, std::size_t pos);
+
+#endif //ELLIS_LEX_SIMD_HPP
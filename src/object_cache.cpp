@@ -0,0 +1,129 @@
+//
+// Created by jonathan on 10/17/26.
+//
+
+#include "object_cache.hpp"
+
+#include <chrono>
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/Support/CachePruning.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/SHA1.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+DiskObjectCache::DiskObjectCache(const orc::JITTargetMachineBuilder& Target, const CodeGenOpt::Level OptLevel,
+                                 const StringRef tier) {
+    raw_string_ostream out(target);
+    out << LLVM_VERSION_STRING << '\0' << Target.getTargetTriple().str() << '\0' << Target.getCPU() << '\0'
+        << Target.getFeatures().getString() << '\0' << static_cast<int>(OptLevel) << '\0' << tier;
+}
+
+DiskObjectCache::~DiskObjectCache() {
+    if (directory.empty() || stored == 0)
+        return;
+    // Only the size limit evicts: no expiry by age, and no limit relative to
+    // the free space on the disk.
+    CachePruningPolicy policy;
+    policy.Interval = std::chrono::seconds(0);
+    policy.Expiration = std::chrono::seconds(0);
+    policy.MaxSizePercentageOfAvailableSpace = 0;
+    policy.MaxSizeBytes = max_bytes;
+    pruneCache(directory, policy);
+}
+
+Error DiskObjectCache::open(const ObjectCacheOptions& options) {
+    SmallString<128> path(options.path);
+    if (path.empty()) {
+        if (!sys::path::cache_directory(path))
+            return createStringError(inconvertibleErrorCode(), "no home or cache directory to keep objects in");
+        sys::path::append(path, "ellis");
+    }
+    if (const auto error = sys::fs::create_directories(path))
+        return createStringError(error, "cannot create " + path.str() + ": " + error.message());
+    directory = path.str().str();
+    max_bytes = options.max_bytes;
+    return Error::success();
+}
+
+std::string DiskObjectCache::key(const Module& M) const {
+    SmallVector<char, 0> bitcode;
+    raw_svector_ostream stream(bitcode);
+    WriteBitcodeToFile(M, stream);
+    SHA1 hash;
+    hash.update(StringRef(bitcode.data(), bitcode.size()));
+    hash.update(target);
+    return toHex(hash.final(), true);
+}
+
+std::string DiskObjectCache::entry(const std::string& key) const {
+    // pruneCache() only ever removes files named like this.
+    SmallString<128> path(directory);
+    sys::path::append(path, "llvmcache-" + key);
+    return path.str().str();
+}
+
+std::unique_ptr<MemoryBuffer> DiskObjectCache::getObject(const Module* M) {
+    if (directory.empty())
+        return nullptr;
+    auto name = key(*M);
+    const auto path = entry(name);
+
+    int fd;
+    if (sys::fs::openFileForRead(path, fd)) {
+        // A miss: the object compiled next is stored under this key.
+        std::lock_guard lock(mutex);
+        pending[M] = std::move(name);
+        return nullptr;
+    }
+    // Pruning goes by access time, which the file system may not update.
+    sys::fs::setLastAccessAndModificationTime(fd, std::chrono::system_clock::now());
+    auto file = sys::fs::convertFDToNativeFile(fd);
+    auto buffer = MemoryBuffer::getOpenFile(file, path, -1);
+    sys::fs::closeFile(file);
+    if (!buffer)
+        return nullptr;
+    loaded++;
+    return std::move(*buffer);
+}
+
+void DiskObjectCache::notifyObjectCompiled(const Module* M, const MemoryBufferRef Obj) {
+    std::string name;
+    {
+        std::lock_guard lock(mutex);
+        const auto it = pending.find(M);
+        if (it == pending.end())
+            return;
+        name = std::move(it->second);
+        pending.erase(it);
+    }
+
+    // Write the object under a name of its own and move it into place in one
+    // step, so no process ever reads a partial entry.
+    int fd;
+    SmallString<128> temporary;
+    if (sys::fs::createUniqueFile(entry("tmp-%%%%%%%%"), fd, temporary))
+        return;
+    {
+        raw_fd_ostream out(fd, true);
+        out << Obj.getBuffer();
+        out.close();
+        if (out.has_error()) {
+            out.clear_error();
+            sys::fs::remove(temporary);
+            return;
+        }
+    }
+    if (sys::fs::rename(temporary, entry(name))) {
+        sys::fs::remove(temporary);
+        return;
+    }
+    stored++;
+}
@@ -0,0 +1,74 @@
+//
+// Created by jonathan on 10/17/26.
+//
+
+#ifndef ELLIS_OBJECT_CACHE_HPP
+#define ELLIS_OBJECT_CACHE_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/ExecutionEngine/ObjectCache.h"
+#include "llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/CodeGen.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+/// ObjectCacheOptions - Where and how much a DiskObjectCache keeps on disk.
+struct ObjectCacheOptions {
+    /// Directory of the cache; empty for ~/.cache/ellis (or its XDG
+    /// equivalent).
+    std::string path;
+    /// Size the directory is pruned to, least recently used objects first;
+    /// 0 for no limit.
+    std::uint64_t max_bytes = 256 * 1024 * 1024;
+};
+
+/// DiskObjectCache - Machine code the JIT compiled in earlier runs, kept on
+/// disk so that an unchanged module is loaded instead of lowered again.
+///
+/// An object is keyed by a SHA-1 of the module's bitcode, as it stands after
+/// optimization, together with the LLVM version, the target triple, CPU,
+/// features and code generation level, and the tier of tiered code. Entries
+/// are written to a temporary file and renamed into place, so several ellisc
+/// processes may share a directory: a reader sees either a whole object or
+/// none. Reading an entry marks it as recently used; when a run that added
+/// entries ends, the directory is pruned down to its size limit.
+///
+/// Does nothing until open() succeeds.
+class DiskObjectCache : public llvm::ObjectCache {
+    std::string target; // everything besides the module that shapes its code
+    std::string directory;
+    std::uint64_t max_bytes = 0;
+
+    std::mutex mutex;
+    llvm::DenseMap<const llvm::Module*, std::string> pending; // keys of modules being compiled
+    std::atomic<unsigned> loaded{0};
+    std::atomic<unsigned> stored{0};
+
+    std::string key(const llvm::Module& M) const;
+    std::string entry(const std::string& key) const;
+public:
+    DiskObjectCache(const llvm::orc::JITTargetMachineBuilder& Target, llvm::CodeGenOpt::Level OptLevel,
+                    llvm::StringRef tier = "");
+    ~DiskObjectCache() override;
+
+    /// Starts caching in the directory `options` names, creating it if
+    /// needed. Must be called before the JIT compiles anything.
+    llvm::Error open(const ObjectCacheOptions& options);
+
+    void notifyObjectCompiled(const llvm::Module* M, llvm::MemoryBufferRef Obj) override;
+    std::unique_ptr<llvm::MemoryBuffer> getObject(const llvm::Module* M) override;
+
+    /// Number of objects loaded from the cache and added to it so far.
+    unsigned hits() const { return loaded; }
+    unsigned stores() const { return stored; }
+};
+
+#endif //ELLIS_OBJECT_CACHE_HPP
@@ -0,0 +1,144 @@
+//
+// Created by jonathan on 10/17/26.
+//
+
+#ifndef ELLIS_OPERATORS_HPP
+#define ELLIS_OPERATORS_HPP
+
+#include <array>
+#include <cstdint>
+#include <string_view>
+
+#include "llvm/IR/InstrTypes.h"
+#include "llvm/IR/Instruction.h"
+
+/// OperatorKind - Infix operators, classified once by the lexer. Every entry of
+/// infix_operators has one, plus plain assignment.
+enum class OperatorKind : std::uint8_t {
+    none,
+    add,
+    sub,
+    mul,
+    div,
+    rem,
+    pow,
+    bit_and,
+    bit_or,
+    lt,
+    gt,
+    le,
+    ge,
+    eq,
+    ne,
+    assign,
+    add_assign,
+    sub_assign,
+    pow_assign,
+    rem_assign,
+    and_assign,
+    or_assign,
+    count,
+};
+
+enum class Associativity : std::uint8_t {
+    left,
+    right,
+};
+
+/// OperatorInfo - What the parser and code generator need to know about an
+/// operator. Arithmetic operators carry the LLVM instruction they lower to,
+/// comparisons the fcmp predicate; compound assignments carry the opcode of
+/// the operation they apply before storing.
+struct OperatorInfo {
+    std::string_view spelling;
+    int precedence; // higher binds tighter; 0 for OperatorKind::none
+    Associativity associativity;
+    bool assigns;
+    llvm::Instruction::BinaryOps opcode; // BinaryOpsEnd if none
+    llvm::CmpInst::Predicate predicate;  // BAD_FCMP_PREDICATE if none
+};
+
+namespace operators_detail {
+
+using llvm::Instruction;
+using llvm::CmpInst;
+
+constexpr auto no_opcode = Instruction::BinaryOpsEnd;
+constexpr auto no_predicate = CmpInst::BAD_FCMP_PREDICATE;
+constexpr auto L = Associativity::left;
+constexpr auto R = Associativity::right;
+
+constexpr std::array<OperatorInfo, static_cast<std::size_t>(OperatorKind::count)> table = {{
+    {"", 0, L, false, no_opcode, no_predicate},
+    {"+", 20, L, false, Instruction::FAdd, no_predicate},
+    {"-", 20, L, false, Instruction::FSub, no_predicate},
+    {"*", 30, L, false, Instruction::FMul, no_predicate},
+    {"/", 30, L, false, Instruction::FDiv, no_predicate},
+    {"%", 30, L, false, Instruction::FRem, no_predicate},
+    {"^", 40, R, false, no_opcode, no_predicate},
+    {"&", 6, L, false, no_opcode, no_predicate},
+    {"|", 5, L, false, no_opcode, no_predicate},
+    {"<", 10, L, false, no_opcode, CmpInst::FCMP_ULT},
+    {">", 10, L, false, no_opcode, CmpInst::FCMP_UGT},
+    {"<=", 10, L, false, no_opcode, CmpInst::FCMP_ULE},
+    {">=", 10, L, false, no_opcode, CmpInst::FCMP_UGE},
+    {"==", 8, L, false, no_opcode, CmpInst::FCMP_UEQ},
+    {"!=", 8, L, false, no_opcode, CmpInst::FCMP_UNE},
+    {"=", 1, R, true, no_opcode, no_predicate},
+    {"+=", 1, R, true, Instruction::FAdd, no_predicate},
+    {"-=", 1, R, true, Instruction::FSub, no_predicate},
+    {"^=", 1, R, true, no_opcode, no_predicate},
+    {"%=", 1, R, true, Instruction::FRem, no_predicate},
+    {"&=", 1, R, true, no_opcode, no_predicate},
+    {"|=", 1, R, true, no_opcode, no_predicate},
+}};
+
+} // namespace operators_detail
+
+constexpr const OperatorInfo& operator_info(const OperatorKind op) {
+    return operators_detail::table[static_cast<std::size_t>(op)];
+}
+
+constexpr std::string_view operator_spelling(const OperatorKind op) {
+    return operator_info(op).spelling;
+}
+
+/// Classifies the spelling of an operator token, OperatorKind::none if unknown.
+/// Every operator is one character, optionally followed by '='.
+constexpr OperatorKind operator_type(const std::string_view s) {
+    const bool with_eq = s.size() == 2 && s[1] == '=';
+    if (s.size() != 1 && !with_eq)
+        return OperatorKind::none;
+    switch (s[0]) {
+        case '+': return with_eq ? OperatorKind::add_assign : OperatorKind::add;
+        case '-': return with_eq ? OperatorKind::sub_assign : OperatorKind::sub;
+        case '*': return with_eq ? OperatorKind::none : OperatorKind::mul;
+        case '/': return with_eq ? OperatorKind::none : OperatorKind::div;
+        case '%': return with_eq ? OperatorKind::rem_assign : OperatorKind::rem;
+        case '^': return with_eq ? OperatorKind::pow_assign : OperatorKind::pow;
+        case '&': return with_eq ? OperatorKind::and_assign : OperatorKind::bit_and;
+        case '|': return with_eq ? OperatorKind::or_assign : OperatorKind::bit_or;
+        case '<': return with_eq ? OperatorKind::le : OperatorKind::lt;
+        case '>': return with_eq ? OperatorKind::ge : OperatorKind::gt;
+        case '=': return with_eq ? OperatorKind::eq : OperatorKind::assign;
+        case '!': return with_eq ? OperatorKind::ne : OperatorKind::none;
+        default: return OperatorKind::none;
+    }
+}
+
+namespace operators_detail {
+
+constexpr bool table_matches_classifier() {
+    for (std::size_t i = 1; i < table.size(); i++)
+        if (operator_type(table[i].spelling) != static_cast<OperatorKind>(i))
+            return false;
+    return true;
+}
+
+} // namespace operators_detail
+
+static_assert(operators_detail::table_matches_classifier(), "operator table out of order");
+static_assert(operator_type("+=") == OperatorKind::add_assign && operator_type("=") == OperatorKind::assign);
+static_assert(operator_type("+-") == OperatorKind::none && operator_spelling(OperatorKind::ne) == "!=");
+
+#endif //ELLIS_OPERATORS_HPP
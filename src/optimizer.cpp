@@ -0,0 +1,232 @@
+//
+// Created by jonathan on 10/17/26.
+//
+
+#include "optimizer.hpp"
+#include "codegen.hpp"
+#include "llvm/Analysis/CGSCCPassManager.h"
+#include "llvm/Analysis/LoopAnalysisManager.h"
+#include "llvm/IR/LLVMRemarkStreamer.h"
+#include "llvm/IR/PassInstrumentation.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Passes/StandardInstrumentations.h"
+#include "llvm/Remarks/RemarkSerializer.h"
+#include "llvm/Remarks/RemarkStreamer.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Target/TargetMachine.h"
+#include <algorithm>
+#include <vector>
+
+std::optional<OptimizationLevel> opt_level(const std::string_view name) {
+    if (name == "0")
+        return OptimizationLevel::O0;
+    if (name == "1")
+        return OptimizationLevel::O1;
+    if (name == "2")
+        return OptimizationLevel::O2;
+    if (name == "3")
+        return OptimizationLevel::O3;
+    if (name == "s")
+        return OptimizationLevel::Os;
+    return std::nullopt;
+}
+
+CodeGenOpt::Level codegen_opt_level(const OptimizationLevel& level) {
+    switch (level.getSpeedupLevel()) {
+        case 0:
+            return CodeGenOpt::None;
+        case 1:
+            return CodeGenOpt::Less;
+        case 3:
+            return CodeGenOpt::Aggressive;
+        default:
+            return CodeGenOpt::Default;
+    }
+}
+
+void PassTimings::add(const std::string_view pass, const std::chrono::steady_clock::duration time,
+                      const unsigned runs) {
+    std::lock_guard lock(mutex);
+    auto it = totals.find(pass);
+    if (it == totals.end())
+        it = totals.emplace(std::string(pass), Total()).first;
+    it->second.time += time;
+    it->second.runs += runs;
+}
+
+void PassTimings::print(raw_ostream& out) const {
+    std::lock_guard lock(mutex);
+    std::vector<std::pair<std::string_view, Total>> rows(totals.begin(), totals.end());
+    std::stable_sort(rows.begin(), rows.end(),
+                     [](const auto& a, const auto& b) { return a.second.time > b.second.time; });
+    std::chrono::duration<double> total{};
+    for (const auto& row : rows)
+        total += row.second.time;
+
+    out << "===" << std::string(73, '-') << "===\n"
+        << "                      Ellis pass execution timing report\n"
+        << "===" << std::string(73, '-') << "===\n"
+        << "  Total Execution Time: " << format("%.4f", total.count()) << " seconds (wall clock)\n\n"
+        << "   ---Wall Time---   --Runs--  --- Name ---\n";
+    for (const auto& [name, row] : rows) {
+        const std::chrono::duration<double> time = row.time;
+        const auto share = total.count() > 0 ? 100 * time.count() / total.count() : 0.0;
+        out << format("   %7.4f (%5.1f%%)  %8u  ", time.count(), share, row.runs) << name << "\n";
+    }
+    out << format("   %7.4f (100.0%%)            Total\n", total.count());
+    out.flush();
+}
+
+RemarkLog::RemarkLog(const std::string& path) {
+    std::error_code error;
+    out = std::make_unique<raw_fd_ostream>(path, error, sys::fs::OF_None);
+    if (error)
+        throw CodeGenerationException("Cannot open " + path + ": " + error.message());
+}
+
+void RemarkLog::append(const StringRef yaml) {
+    std::lock_guard lock(mutex);
+    *out << yaml;
+    out->flush();
+}
+
+namespace {
+
+/// Times the passes of one run through instrumentation callbacks and adds
+/// the results to a PassTimings when it goes out of scope. A pass or
+/// analysis started while another is running pauses the outer one.
+class PassTimer {
+    using Clock = std::chrono::steady_clock;
+    struct Running {
+        StringRef name;
+        Clock::time_point since;
+    };
+    struct Total {
+        Clock::duration time{};
+        unsigned runs = 0;
+    };
+    PassTimings& timings;
+    std::vector<Running> stack;
+    StringMap<Total> totals;
+
+    void start(const StringRef name) {
+        const auto now = Clock::now();
+        if (!stack.empty())
+            totals[stack.back().name].time += now - stack.back().since;
+        stack.push_back({name, now});
+    }
+
+    void stop() {
+        const auto now = Clock::now();
+        auto& total = totals[stack.back().name];
+        total.time += now - stack.back().since;
+        total.runs++;
+        stack.pop_back();
+        if (!stack.empty())
+            stack.back().since = now;
+    }
+
+    // Pass managers, adaptors and proxies only run other passes.
+    static bool ignored(const StringRef pass) {
+        return isSpecialPass(pass, {"PassManager", "PassAdaptor", "AnalysisManagerProxy",
+                                    "ModuleInlinerWrapperPass", "DevirtSCCRepeatedPass"});
+    }
+public:
+    PassTimer(PassTimings& timings, PassInstrumentationCallbacks& PIC) : timings(timings) {
+        PIC.registerBeforeNonSkippedPassCallback([this](StringRef P, Any) {
+            if (!ignored(P))
+                start(P);
+        });
+        PIC.registerAfterPassCallback([this](StringRef P, Any, const PreservedAnalyses&) {
+            if (!ignored(P))
+                stop();
+        });
+        PIC.registerAfterPassInvalidatedCallback([this](StringRef P, const PreservedAnalyses&) {
+            if (!ignored(P))
+                stop();
+        });
+        PIC.registerBeforeAnalysisCallback([this](StringRef P, Any) {
+            if (!ignored(P))
+                start(P);
+        });
+        PIC.registerAfterAnalysisCallback([this](StringRef P, Any) {
+            if (!ignored(P))
+                stop();
+        });
+    }
+    PassTimer(const PassTimer&) = delete;
+    PassTimer& operator=(const PassTimer&) = delete;
+
+    ~PassTimer() {
+        for (const auto& entry : totals)
+            timings.add(std::string_view(entry.first()), entry.second.time, entry.second.runs);
+    }
+};
+
+/// Streams the optimization remarks of one module to a string while it is
+/// in scope, then appends them to a RemarkLog.
+class RemarkCapture {
+    LLVMContext& context;
+    RemarkLog& log;
+    std::string yaml;
+    raw_string_ostream stream{yaml};
+public:
+    RemarkCapture(Module& module, RemarkLog& log) : context(module.getContext()), log(log) {
+        auto serializer = remarks::createRemarkSerializer(remarks::Format::YAML,
+                                                          remarks::SerializerMode::Separate, stream);
+        if (!serializer)
+            throw CodeGenerationException("Cannot record remarks: " + toString(serializer.takeError()));
+        context.setMainRemarkStreamer(std::make_unique<remarks::RemarkStreamer>(std::move(*serializer)));
+        context.setLLVMRemarkStreamer(std::make_unique<LLVMRemarkStreamer>(*context.getMainRemarkStreamer()));
+    }
+    RemarkCapture(const RemarkCapture&) = delete;
+    RemarkCapture& operator=(const RemarkCapture&) = delete;
+
+    ~RemarkCapture() {
+        context.setLLVMRemarkStreamer(nullptr);
+        context.setMainRemarkStreamer(nullptr);
+        log.append(stream.str());
+    }
+};
+
+} // namespace
+
+void Optimizer::run(Module& module) const {
+    auto builder = target;
+    auto machine = builder.createTargetMachine();
+    if (!machine)
+        throw CodeGenerationException("Cannot create target machine: " + toString(machine.takeError()));
+
+    PassInstrumentationCallbacks PIC;
+    std::optional<PassTimer> timer;
+    if (timings)
+        timer.emplace(*timings, PIC);
+
+    LoopAnalysisManager LAM;
+    FunctionAnalysisManager FAM;
+    CGSCCAnalysisManager CGAM;
+    ModuleAnalysisManager MAM;
+    StandardInstrumentations SI(false);
+    SI.registerCallbacks(PIC, &FAM);
+    std::optional<RemarkCapture> capture;
+    if (remarks)
+        capture.emplace(module, *remarks);
+
+    // As clang does, vectorize from -O2 (and -Os) up.
+    PipelineTuningOptions tuning;
+    tuning.LoopVectorization = level.getSpeedupLevel() > 1;
+    tuning.SLPVectorization = level.getSpeedupLevel() > 1;
+
+    PassBuilder PB(machine->get(), tuning, None, &PIC);
+    PB.registerModuleAnalyses(MAM);
+    PB.registerCGSCCAnalyses(CGAM);
+    PB.registerFunctionAnalyses(FAM);
+    PB.registerLoopAnalyses(LAM);
+    PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+
+    auto MPM = level == OptimizationLevel::O0 ? PB.buildO0DefaultPipeline(level)
+                                              : PB.buildPerModuleDefaultPipeline(level);
+    MPM.run(module, MAM);
+}
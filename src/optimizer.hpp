@@ -0,0 +1,92 @@
+//
+// Created by jonathan on 10/17/26.
+//
+
+#ifndef ELLIS_OPTIMIZER_HPP
+#define ELLIS_OPTIMIZER_HPP
+
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Passes/OptimizationLevel.h"
+#include "llvm/Support/CodeGen.h"
+#include "llvm/Support/raw_ostream.h"
+
+/// The level named by an ellisc -O flag ("0", "1", "2", "3" or "s").
+std::optional<llvm::OptimizationLevel> opt_level(std::string_view name);
+
+/// Machine code optimization level matching an IR optimization level.
+llvm::CodeGenOpt::Level codegen_opt_level(const llvm::OptimizationLevel& level);
+
+/// PassTimings - Wall time spent in each pass and analysis, summed over
+/// every run of an Optimizer and every thread running one. A pass's time
+/// excludes the passes and analyses it runs itself.
+class PassTimings {
+    struct Total {
+        std::chrono::steady_clock::duration time{};
+        unsigned runs = 0;
+    };
+    mutable std::mutex mutex;
+    std::map<std::string, Total, std::less<>> totals;
+public:
+    void add(std::string_view pass, std::chrono::steady_clock::duration time, unsigned runs);
+
+    /// Writes a table of the passes, slowest first.
+    void print(llvm::raw_ostream& out) const;
+};
+
+/// RemarkLog - YAML file collecting the optimization remarks (passed, missed
+/// and analysis) of every run of an Optimizer. Each run serializes its
+/// remarks on its own and appends them whole, so runs on several threads
+/// never interleave their documents.
+class RemarkLog {
+    std::mutex mutex;
+    std::unique_ptr<llvm::raw_fd_ostream> out;
+public:
+    /// Truncates or creates `path`; throws a CodeGenerationException if it
+    /// cannot be opened.
+    explicit RemarkLog(const std::string& path);
+
+    void append(llvm::StringRef yaml);
+};
+
+/// Optimizer - Runs the standard PassBuilder per-module pipeline of one
+/// optimization level over generated modules, with the cost models of the
+/// target the JIT compiles for. Every run builds its own analysis managers
+/// and TargetMachine, so modules of different LLVMContexts may be optimized
+/// on several threads at once.
+class Optimizer {
+    llvm::OptimizationLevel level;
+    llvm::orc::JITTargetMachineBuilder target;
+    std::shared_ptr<PassTimings> timings;
+    std::shared_ptr<RemarkLog> remarks;
+public:
+    Optimizer(const llvm::OptimizationLevel level, llvm::orc::JITTargetMachineBuilder target)
+        : level(level), target(std::move(target)) {}
+
+    const llvm::OptimizationLevel& getLevel() const { return level; }
+
+    /// Starts timing every pass of later runs.
+    void timePasses() { timings = std::make_shared<PassTimings>(); }
+    const PassTimings* getTimings() const { return timings.get(); }
+
+    /// Records the optimization remarks of later runs to a YAML file.
+    void writeRemarks(const std::string& path) { remarks = std::make_shared<RemarkLog>(path); }
+
+    /// Adds the timings and remarks of later runs to those of `other`.
+    void reportTo(const Optimizer& other) {
+        timings = other.timings;
+        remarks = other.remarks;
+    }
+
+    void run(llvm::Module& module) const;
+};
+
+#endif //ELLIS_OPTIMIZER_HPP
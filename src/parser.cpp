@@ -6,390 +6,556 @@
 #include "lex.hpp"
 #include <iostream>
 #include <cmath>
+#include <thread>
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/ThreadPool.h"
 
-std::unique_ptr<ExprAST> parse_paren_expr(std::vector<TokenPair>& tokens);
-std::unique_ptr<ExprAST> parse_primary(std::vector<TokenPair>& tokens, Token terminator);
-std::vector<std::unique_ptr<AST>> parse_body(std::vector<TokenPair>& tokens);
-std::unique_ptr<ExprAST> parse_bin_op_rhs(std::vector<TokenPair>& tokens, int ExprPrec, std::unique_ptr<ExprAST> LHS, Token terminator);
+ListId parse_body(TokenStream& tokens, ASTContext& ctx);
 
 
-const std::map<std::string, int> BinopPrecedence = {
-        {">", 10},
-        {"<", 10},
-        {"+", 20},
-        {"-", 20},
-        {"*", 30},
-        {"/", 30},
-        {"^", 40},
-};
-
-
-std::unique_ptr<ExprAST> parse_expression(std::vector<TokenPair>& tokens, const Token terminator=tok_semicolon) {
-    auto lhs = parse_primary(tokens, terminator);
-    if (tokens[0].first == terminator) {
-        tokens.erase(tokens.begin());
-        return lhs;
-    } else {
-        // infix operator
-        if (tokens[0].first == tok_operator) {
-            lhs = parse_bin_op_rhs(tokens, 0, std::move(lhs), terminator);
-        }
-    }
-
-    if (tokens[0].first != terminator) {
-        throw ParsingException("Expected terminator at the end of expression, got: " + tokens[0].second );
-    }
-    tokens.erase(tokens.begin());
 
-    if (!lhs) {
-        return nullptr;
-    }
-    return lhs;
-}
-
-std::unique_ptr<ExprAST> parse_argument(std::vector<TokenPair>& tokens) {
-    switch (tokens[0].first) {
-        case tok_number: {
-            const auto num = tokens[0].second;
-            tokens.erase(tokens.begin());
-            return std::make_unique<NumberExprAST>(NumberExprAST(std::stod(num)));
-        }
-        case tok_identifier: {
-            const auto name = tokens[0].second;
-            tokens.erase(tokens.begin());
-            return std::make_unique<VariableExprAST>(VariableExprAST(name));
-        }
-        case tok_string_literal: {
-            const auto str = tokens[0].second;
-            tokens.erase(tokens.begin());
-            return std::make_unique<StringExprAST>(StringExprAST(str));
-        }
-        case tok_char_literal: {
-            const auto ch = tokens[0].second[0];
-            tokens.erase(tokens.begin());
-            return std::make_unique<CharExprAST>(CharExprAST(ch));
-        }
-        case tok_lparen:
-            return parse_paren_expr(tokens);
-        default:
-            throw ParsingException("Unexpected token while parsing function argument: " + tokens[0].second);
-    }
+// Consumes the next token and returns a copy of its spelling.
+std::string take_text(TokenStream& tokens) {
+    auto text = std::string(tokens.text());
+    tokens.advance();
+    return text;
 }
 
-std::unique_ptr<ExprAST> parse_identifier_expr(std::vector<TokenPair>& tokens, const Token terminator=tok_semicolon) {
-    auto name = tokens[0].second;
-    tokens.erase(tokens.begin()); // remove 'name'
-
-    // Next token can be:
-    // 1. number
-    // 2. ident
-    // 3. (
-    // OR
-    // 4. binaryOp
-    switch (tokens[0].first) {
-        case tok_identifier:
-        case tok_char_literal:
-        case tok_string_literal:
-        case tok_number:
-        case tok_lparen: {
-            std::vector<std::unique_ptr<ExprAST>> arguments;
-            while (tokens[0].first != terminator) {
-                arguments.push_back(std::move(parse_argument(tokens)));
-            }
-
-            auto ast = CallExprAST(name, std::move(arguments));
-            return std::make_unique<CallExprAST>(std::move(ast));
-        }
-        case tok_operator: {
-            auto lhs = std::make_unique<VariableExprAST>(name);
-            auto rhs = parse_bin_op_rhs(tokens, 0, std::move(lhs), terminator);
-            return std::move(rhs);
-        }
-        default:
-            if (tokens[0].first == terminator) {
-                return std::make_unique<VariableExprAST>(VariableExprAST(name));
-            }
-            throw ParsingException("Expected " + TOKEN_STRINGS.at(terminator) + ", found: " + tokens[0].second);
-    }
+// Consumes the next token and returns its interned spelling.
+Symbol take_symbol(TokenStream& tokens) {
+    const auto symbol = intern(tokens.text());
+    tokens.advance();
+    return symbol;
 }
 
-std::unique_ptr<ExprAST> parse_number_expr(std::vector<TokenPair>& tokens, const Token terminator=tok_semicolon) {
-    auto ast = std::make_unique<NumberExprAST>(NumberExprAST(std::stod(tokens[0].second)));
-    tokens.erase(tokens.begin());
-    return std::move(ast);
+NodeId parse_number_expr(TokenStream& tokens, ASTContext& ctx) {
+    const auto kind = tokens.peek().kind();
+    const auto value = tokens.literal();
+    tokens.advance();
+    if (kind == tok_integer)
+        return ctx.integer(value.integer);
+    return ctx.floating(value.floating);
 }
 
-std::unique_ptr<ExprAST> parse_string_expr(std::vector<TokenPair>& tokens) {
-    auto ast = std::make_unique<StringExprAST>(StringExprAST(tokens[0].second));
-    tokens.erase(tokens.begin());
-    return std::move(ast);
+NodeId parse_string_expr(TokenStream& tokens, ASTContext& ctx) {
+    const auto node = ctx.string(tokens.text());
+    tokens.advance();
+    return node;
 }
 
-std::unique_ptr<ExprAST> parse_char_expr(std::vector<TokenPair>& tokens) {
-    auto ast = std::make_unique<CharExprAST>(CharExprAST(tokens[0].second[0]));
-    tokens.erase(tokens.begin());
-    return std::move(ast);
+NodeId parse_char_expr(TokenStream& tokens, ASTContext& ctx) {
+    return ctx.character(take_text(tokens)[0]);
 }
 
-std::unique_ptr<ExprAST> parse_paren_expr(std::vector<TokenPair>& tokens) {
-    tokens.erase(tokens.begin()); // remove '('
-    if (tokens[0].first == tok_rparen) {
-        tokens.erase(tokens.begin()); // remove ')'
-        return std::make_unique<UnitExprAST>(UnitExprAST());
-    }
-    auto expr = parse_expression(tokens, tok_rparen);
-    if (!expr) {
-        return nullptr;
+// Parses a literal if the next token is one, otherwise returns no_node.
+NodeId parse_literal(TokenStream& tokens, ASTContext& ctx) {
+    switch (tokens.peek().kind()) {
+        case tok_integer:
+        case tok_float:
+            return parse_number_expr(tokens, ctx);
+        case tok_char_literal:
+            return parse_char_expr(tokens, ctx);
+        case tok_string_literal:
+            return parse_string_expr(tokens, ctx);
+        default:
+            return no_node;
     }
-
-    return expr;
 }
 
-std::unique_ptr<ExprAST> parse_primary(std::vector<TokenPair>& tokens, const Token terminator=tok_semicolon) {
-    switch (tokens[0].first) {
+// Tokens that start a call argument, so `name` followed by one is a call.
+bool starts_argument(const Token kind) {
+    switch (kind) {
         case tok_identifier:
-            return parse_identifier_expr(tokens, terminator);
-        case tok_number:
-            return parse_number_expr(tokens);
         case tok_char_literal:
-            return parse_char_expr(tokens);
         case tok_string_literal:
-            return parse_string_expr(tokens);
+        case tok_integer:
+        case tok_float:
         case tok_lparen:
-            return parse_paren_expr(tokens);
+            return true;
         default:
-            throw ParsingException("Unexpected token when parsing primary expression: " + tokens[0].second);
+            return false;
     }
 }
 
-int get_tok_precedence(const TokenPair& t) {
-    // Make sure it's a declared binop.
-    int TokPrec = BinopPrecedence.at(t.second);
-    if (TokPrec <= 0) return -1;
-    return TokPrec;
+// Operator of the next token; throws unless it is a known binary operator.
+OperatorKind peek_binop(TokenStream& tokens) {
+    const auto op = tokens.op();
+    if (op == OperatorKind::none)
+        throw ParsingException("Unknown binary operator: " + std::string(tokens.text()), tokens.location());
+    return op;
 }
 
-std::unique_ptr<ExprAST> parse_bin_op_rhs(std::vector<TokenPair>& tokens, int ExprPrec, std::unique_ptr<ExprAST> LHS,
-                                          const Token terminator) {
-    // If this is a binop, find its precedence.
-    while (true) {
-        if (tokens[0].first == terminator)
-            return LHS;
-
-        int TokPrec = get_tok_precedence(tokens[0]);
+// An open construct on parse_expression's frame stack: the whole expression
+// or a parenthesised group, closed by `terminator`, or a call collecting its
+// arguments up to the terminator of the group around it. Its operators and
+// operands (or arguments) are those above the two bases.
+struct ExprFrame {
+    enum Kind : std::uint8_t { group, call } kind;
+    Token terminator;
+    std::size_t operators_base;
+    std::size_t operands_base;
+    Symbol callee = no_symbol;
+};
 
-        // If this is a binop that binds at least as tightly as the current binop,
-        // consume it, otherwise we are done.
-        if (TokPrec < ExprPrec) {
-            std::cout << "Did not bind tightly enough\n";
-            return LHS;
+// Operator-precedence parser for an expression ending in `terminator`, which
+// is consumed. Nesting lives on explicit stacks instead of the native one, so
+// arbitrarily deep parentheses and long operator chains parse in constant
+// native stack, and every token is shifted and reduced once.
+//
+// Operators are kept on `operators` until one of lower precedence (or equal,
+// for a left-associative one) arrives; calls take atoms and parenthesised
+// groups as arguments up to the terminator of the group they appear in.
+NodeId parse_expression(TokenStream& tokens, ASTContext& ctx, const Token terminator=tok_semicolon) {
+    llvm::SmallVector<NodeId, 16> operands;
+    llvm::SmallVector<OperatorKind, 16> operators;
+    llvm::SmallVector<ExprFrame, 8> frames;
+    frames.push_back({ExprFrame::group, terminator, 0, 0});
+
+    const auto reduce = [&]() {
+        const auto rhs = operands.pop_back_val();
+        const auto lhs = operands.pop_back_val();
+        operands.push_back(ctx.binary(operators.pop_back_val(), lhs, rhs));
+    };
+    // Consumes '(' and either pushes `()` or opens a group; true if it opened one.
+    const auto open_paren = [&]() {
+        tokens.advance(); // remove '('
+        if (tokens.peek().kind() == tok_rparen) {
+            tokens.advance(); // remove ')'
+            operands.push_back(ctx.unit());
+            return false;
         }
+        frames.push_back({ExprFrame::group, tok_rparen, operators.size(), operands.size()});
+        return true;
+    };
 
-        // Okay, we know this is a binop.
-        std::string BinOp = tokens[0].second;
-        tokens.erase(tokens.begin());
-
-        // Parse the primary expression after the binary operator.
-        auto RHS = parse_primary(tokens, terminator);
-        if (!RHS)
-            return nullptr;
-
-        if (tokens[0].first == terminator)
-            return std::make_unique<BinaryExprAST>(BinOp, std::move(LHS), std::move(RHS));
-
-        // If BinOp binds less tightly with RHS than the operator after RHS, let
-        // the pending operator take RHS as its LHS.
-        int NextPrec = get_tok_precedence(tokens[0]);
-        if (TokPrec < NextPrec) {
-            RHS = parse_bin_op_rhs(tokens, TokPrec + 1, std::move(RHS), terminator);
-            if (!RHS)
-                return nullptr;
+    enum { expect_operand, expect_operator, expect_argument } state = expect_operand;
+    while (true) {
+        const auto& frame = frames.back();
+        const auto kind = tokens.peek().kind();
+
+        switch (state) {
+            case expect_operand: {
+                if (kind == tok_lparen) {
+                    if (!open_paren())
+                        state = expect_operator;
+                    break;
+                }
+                if (kind == tok_identifier) {
+                    const auto name = take_symbol(tokens);
+                    if (starts_argument(tokens.peek().kind())) {
+                        frames.push_back({ExprFrame::call, frame.terminator, operators.size(), operands.size(), name});
+                        state = expect_argument;
+                    } else {
+                        operands.push_back(ctx.variable(name));
+                        state = expect_operator;
+                    }
+                    break;
+                }
+                const auto literal = parse_literal(tokens, ctx);
+                if (literal == no_node)
+                    throw ParsingException("Unexpected token when parsing primary expression: " + std::string(tokens.text()), tokens.location());
+                operands.push_back(literal);
+                state = expect_operator;
+                break;
+            }
+            case expect_argument: {
+                if (kind == frame.terminator) {
+                    const auto args = llvm::makeArrayRef(operands).drop_front(frame.operands_base);
+                    const auto call = ctx.call(frame.callee, ctx.list(args));
+                    operands.truncate(frame.operands_base);
+                    operands.push_back(call);
+                    frames.pop_back();
+                    state = expect_operator;
+                    break;
+                }
+                if (kind == tok_lparen) {
+                    if (open_paren())
+                        state = expect_operand;
+                    break;
+                }
+                if (kind == tok_identifier) {
+                    operands.push_back(ctx.variable(take_symbol(tokens)));
+                    break;
+                }
+                const auto literal = parse_literal(tokens, ctx);
+                if (literal == no_node)
+                    throw ParsingException("Unexpected token while parsing function argument: " + std::string(tokens.text()), tokens.location());
+                operands.push_back(literal);
+                break;
+            }
+            case expect_operator: {
+                if (kind == frame.terminator) {
+                    while (operators.size() > frame.operators_base)
+                        reduce();
+                    tokens.advance(); // remove terminator
+                    frames.pop_back();
+                    if (frames.empty())
+                        return operands.back();
+                    state = frames.back().kind == ExprFrame::call ? expect_argument : expect_operator;
+                    break;
+                }
+                if (kind != tok_operator)
+                    tokens.expect(frame.terminator, "Expected terminator at the end of expression");
+
+                const auto op = peek_binop(tokens);
+                const auto& info = operator_info(op);
+                while (operators.size() > frame.operators_base) {
+                    const auto& top = operator_info(operators.back());
+                    if (top.precedence < info.precedence ||
+                        (top.precedence == info.precedence && info.associativity == Associativity::right))
+                        break;
+                    reduce();
+                }
+                operators.push_back(op);
+                tokens.advance();
+                state = expect_operand;
+                break;
+            }
         }
-
-        // Merge LHS/RHS.
-        LHS = std::make_unique<BinaryExprAST>(BinOp, std::move(LHS), std::move(RHS));
     }
 }
 
-std::unique_ptr<StatementAST> parse_let(std::vector<TokenPair>& tokens) {
+NodeId parse_let(TokenStream& tokens, ASTContext& ctx) {
 
     // remove LET
-    tokens.erase(tokens.begin());
+    tokens.advance();
     if (tokens.empty()) {
-        throw ParsingException("Expected identifier after let statement");
+        throw ParsingException("Expected identifier after let statement", tokens.location());
     }
 
-    if (tokens[0].first != tok_identifier) {
-        throw ParsingException("Expected identifier after let, got " + tokens[0].second);
-    }
-
-    const auto ident = tokens[0].second;
     // remove variable name
-    tokens.erase(tokens.begin());
+    const auto ident = intern(tokens.spelling(tokens.expect(tok_identifier, "Expected identifier after let")));
 
-    switch (tokens[0].first) {
+    switch (tokens.peek().kind()) {
         case tok_operator: {
-            if (tokens[0].second != "=") {
-                throw ParsingException("Unexpected operator in let statement: " + tokens[0].second);
+            if (tokens.op() != OperatorKind::assign) {
+                throw ParsingException("Unexpected operator in let statement: " + std::string(tokens.text()), tokens.location());
             }
-            tokens.erase(tokens.begin()); // remove '='
-            auto expr = parse_expression(tokens);
-            return std::make_unique<VariableDefAST>(ident, std::move(expr));
+            tokens.advance(); // remove '='
+            auto expr = parse_expression(tokens, ctx);
+            return ctx.variableDef(ident, expr);
         }
         case tok_identifier: {
-            auto arg_names = std::vector<std::string>();
-            while (tokens[0].first == tok_identifier) {
-                arg_names.push_back(tokens[0].second);
-                if (tokens.empty())
-                    throw ParsingException("Expected '=' before function body");
-                tokens.erase(tokens.begin());
+            llvm::SmallVector<Symbol, 8> arg_names;
+            while (tokens.peek().kind() == tok_identifier) {
+                arg_names.push_back(take_symbol(tokens));
             }
 
-            if (tokens[0].second == "=") {
-                auto ast = PrototypeAST(ident, arg_names);
-                tokens.erase(tokens.begin());
-                auto func =  std::make_unique<FunctionAST>(FunctionAST(std::make_unique<PrototypeAST>(ast), parse_body(tokens)));
-                tokens.erase(tokens.begin()); // remove 'end'
-                return std::move(func);
+            if (tokens.op() == OperatorKind::assign) {
+                auto proto = ctx.prototype(ident, ctx.list(arg_names));
+                tokens.advance();
+                auto func = ctx.function(proto, parse_body(tokens, ctx));
+                tokens.expect(tok_end, "Expected 'end' at end of function definition"); // remove 'end'
+                return func;
             }
-            throw ParsingException("Expected '=' before function body");
+            throw ParsingException("Expected '=' before function body", tokens.location());
         }
         case tok_lparen: {
-            tokens.erase(tokens.begin());
-            if (tokens[0].first != tok_rparen) {
-                throw ParsingException("Expected closing ')' in unit function");
-            }
-            auto ast = PrototypeAST(ident, std::vector<std::string>());
-            tokens.erase(tokens.begin());
-            if (tokens[0].second != "=")
-                throw ParsingException("Expected '=' before function body");
-
-            tokens.erase(tokens.begin());
-            auto func = std::make_unique<FunctionAST>(FunctionAST(std::make_unique<PrototypeAST>(ast), parse_body(tokens)));
-            tokens.erase(tokens.begin());
-            return std::move(func);
+            tokens.advance();
+            tokens.expect(tok_rparen, "Expected closing ')' in unit function");
+            auto proto = ctx.prototype(ident, ctx.list({}));
+            if (tokens.op() != OperatorKind::assign)
+                throw ParsingException("Expected '=' before function body", tokens.location());
+
+            tokens.advance();
+            auto func = ctx.function(proto, parse_body(tokens, ctx));
+            tokens.expect(tok_end, "Expected 'end' at end of function definition");
+            return func;
         }
         default:
-            throw ParsingException("Expected identifier, '=' or '(' in let statement, received: " + tokens[0].second);
+            throw ParsingException("Expected identifier, '=' or '(' in let statement, received: " + std::string(tokens.text()), tokens.location());
     }
 }
 
-std::unique_ptr<IfAST> parse_if(std::vector<TokenPair>& tokens) {
-    tokens.erase(tokens.begin()); // remove 'if'
-    auto conditional = parse_expression(tokens, tok_then);
-    auto body_true = parse_body(tokens);
-    if (tokens[0].first == tok_end) {
-        tokens.erase(tokens.begin());
-        return std::make_unique<IfAST>(IfAST(std::move(conditional), std::move(body_true), {}));
+NodeId parse_if(TokenStream& tokens, ASTContext& ctx) {
+    tokens.advance(); // remove 'if'
+    auto conditional = parse_expression(tokens, ctx, tok_then);
+    auto body_true = parse_body(tokens, ctx);
+    if (tokens.peek().kind() == tok_end) {
+        tokens.advance();
+        return ctx.ifElse(conditional, body_true, ctx.list({}));
     }
 
-    if (tokens[0].first == tok_else) {
-        tokens.erase(tokens.begin());
-        auto body_false = parse_body(tokens);
-        tokens.erase(tokens.begin());
-        return std::make_unique<IfAST>(IfAST(std::move(conditional), std::move(body_true), std::move(body_false)));
+    if (tokens.peek().kind() == tok_else) {
+        tokens.advance();
+        auto body_false = parse_body(tokens, ctx);
+        tokens.expect(tok_end, "Expected 'end' at end of if statement");
+        return ctx.ifElse(conditional, body_true, body_false);
     }
 
-    throw ParsingException("Unexpected token while parsing if statement: " + tokens[0].second);
+    throw ParsingException("Unexpected token while parsing if statement: " + std::string(tokens.text()), tokens.location());
 }
 
-std::vector<std::unique_ptr<AST>> parse_body(std::vector<TokenPair>& tokens) {
-    std::vector<std::unique_ptr<AST>> ast;
-    while (tokens[0].first != tok_end && tokens[0].first != tok_else) {
-        auto current_token = tokens[0];
-        switch (current_token.first) {
+ListId parse_body(TokenStream& tokens, ASTContext& ctx) {
+    llvm::SmallVector<NodeId, 16> ast;
+    while (tokens.peek().kind() != tok_end && tokens.peek().kind() != tok_else) {
+        if (tokens.empty())
+            throw ParsingException("Expected 'end' at end of function definition, got EOF", tokens.location());
+        const auto current_token = tokens.peek();
+        switch (current_token.kind()) {
             case tok_let:
-                ast.push_back(parse_let(tokens));
+                ast.push_back(parse_let(tokens, ctx));
             break;
             case tok_return:
-                tokens.erase(tokens.begin()); // remove 'return'
-                if (tokens.size() > 1) {
-                    if (tokens[0].first == tok_semicolon)
-                        ast.push_back(std::make_unique<ReturnAST>(ReturnAST()));
-                    else
-                        ast.push_back(std::make_unique<ReturnAST>(ReturnAST(parse_expression(tokens))));
+                tokens.advance(); // remove 'return'
+                if (!tokens.empty()) {
+                    if (tokens.peek().kind() == tok_semicolon) {
+                        tokens.advance();
+                        ast.push_back(ctx.ret());
+                    } else
+                        ast.push_back(ctx.ret(parse_expression(tokens, ctx)));
                 } else {
-                    throw ParsingException("Unexpected end of function definition");
+                    throw ParsingException("Unexpected end of function definition", tokens.location());
                 }
+                break;
             case tok_identifier:
                 // 1. function call
                 // 2. redefinition of variable
-                if (tokens.size() > 1) {
-                    if (tokens[1].second == "=") {
-                        auto name = current_token.second;
-                        tokens.erase(tokens.begin(), tokens.begin() + 2);
-
-                        auto node = std::make_unique<BinaryExprAST>("=",
-                            std::make_unique<VariableExprAST>(VariableExprAST(name)),
-                            parse_expression(tokens));
-                        ast.push_back(std::move(node));
-                    } else {
-                        ast.push_back(parse_expression(tokens));
-                    }
+                if (tokens.op(1) == OperatorKind::assign) {
+                    const auto name = take_symbol(tokens);
+                    tokens.advance(); // remove '='
+
+                    auto node = ctx.binary(OperatorKind::assign,
+                        ctx.variable(name),
+                        parse_expression(tokens, ctx));
+                    ast.push_back(node);
+                } else {
+                    ast.push_back(parse_expression(tokens, ctx));
                 }
                 break;
-            case tok_number:
+            case tok_integer:
+            case tok_float:
             case tok_char_literal:
             case tok_string_literal:
             case tok_lparen:
-                ast.push_back(parse_expression(tokens));
+                ast.push_back(parse_expression(tokens, ctx));
             break;
             case tok_if:
-                ast.push_back(parse_if(tokens));
+                ast.push_back(parse_if(tokens, ctx));
                 break;
             default:
-                throw ParsingException("Unexpected token: " + current_token.second);
+                throw ParsingException("Unexpected token: " + std::string(tokens.text()), tokens.location());
 
         }
-        if (tokens.empty())
-            throw ParsingException("Expected 'end' at end of function definition, got EOF");
     }
+    return ctx.list(ast);
+}
+
+
+// Parses one top-level statement.
+NodeId parse_toplevel(TokenStream& tokens, ASTContext& ctx) {
+    switch (tokens.peek().kind()) {
+        case tok_let:
+            return parse_let(tokens, ctx);
+        case tok_identifier:
+            // 1. function call
+            // 2. redefinition of variable
+            if (tokens.op(1) == OperatorKind::assign) {
+                const auto name = take_symbol(tokens);
+                tokens.advance(); // remove '='
+
+                return ctx.binary(OperatorKind::assign,
+                    ctx.variable(name),
+                    parse_expression(tokens, ctx));
+            }
+            return parse_expression(tokens, ctx);
+        case tok_integer:
+        case tok_float:
+        case tok_char_literal:
+        case tok_string_literal:
+        case tok_lparen:
+            return parse_expression(tokens, ctx);
+        case tok_if:
+            return parse_if(tokens, ctx);
+        case tok_return:
+            throw ParsingException("'return' statement found outside function definition", tokens.location());
+        default:
+            throw ParsingException("Unexpected token: " + std::string(tokens.text()), tokens.location());
+    }
+}
+
+NodeId parse_next_toplevel(TokenStream& tokens, ASTContext& ctx) {
+    if (tokens.empty())
+        return no_node;
+    return parse_toplevel(tokens, ctx);
+}
+
+std::vector<NodeId> parse(TokenStream& tokens, ASTContext& ctx) {
+    std::vector<NodeId> ast;
+    for (auto root = parse_next_toplevel(tokens, ctx); root != no_node; root = parse_next_toplevel(tokens, ctx))
+        ast.push_back(root);
     return ast;
 }
 
+// Splits `source` into byte ranges of whole top-level statements, each at
+// least `target` bytes long (except the last). Only kinds are looked at:
+// a statement ends at a ';' outside any block or at the 'end' closing its
+// outermost block, where blocks are opened by 'if' and by a function 'let'
+// (one whose name is followed by a parameter or '(' rather than '=').
+std::vector<std::pair<std::size_t, std::size_t>> split_toplevel(std::string_view source, const std::size_t target) {
+    std::vector<std::pair<std::size_t, std::size_t>> chunks;
+    auto lexer = Lexer(source);
+    std::size_t begin = 0;
+    int depth = 0;
+    int after_let = 0; // tokens seen since the last 'let', up to 2
+    for (auto t = lexer.next(); t.kind() != tok_eof; t = lexer.next()) {
+        const auto kind = t.kind();
+        if (after_let == 1) {
+            after_let = kind == tok_identifier ? 2 : 0;
+        } else if (after_let == 2) {
+            if (kind == tok_identifier || kind == tok_lparen)
+                depth++;
+            after_let = 0;
+        }
 
-std::vector<std::unique_ptr<AST>> parse(std::vector<TokenPair>& tokens) {
-    std::vector<std::unique_ptr<AST>> ast;
-    while (!tokens.empty()) {
-        auto current_token = tokens[0];
-        switch (current_token.first) {
+        bool boundary = false;
+        switch (kind) {
             case tok_let:
-                ast.push_back(parse_let(tokens));
+                after_let = 1;
                 break;
-            case tok_identifier:
-                // 1. function call
-                // 2. redefinition of variable
-                if (tokens.size() > 1) {
-                    if (tokens[1].second == "=") {
-                        auto name = current_token.second;
-                        tokens.erase(tokens.begin(), tokens.begin() + 2);
-
-                        auto node = std::make_unique<BinaryExprAST>("=",
-                            std::make_unique<VariableExprAST>(VariableExprAST(name)),
-                            parse_expression(tokens));
-                        ast.push_back(std::move(node));
-                    } else {
-                        ast.push_back(parse_expression(tokens));
-                    }
-                }
-
+            case tok_if:
+                depth++;
                 break;
-            case tok_number:
-            case tok_char_literal:
-            case tok_string_literal:
-            case tok_lparen:
-                ast.push_back(parse_expression(tokens));
+            case tok_end:
+                boundary = --depth <= 0;
                 break;
-            case tok_if:
-                ast.push_back(parse_if(tokens));
+            case tok_semicolon:
+                boundary = depth <= 0;
                 break;
-            case tok_return:
-                throw ParsingException("'return' statement found outside function definition");
             default:
-                throw ParsingException("Unexpected token: " + current_token.second);
+                break;
         }
-        std::cout << *ast.back() << "\n";
+        if (!boundary)
+            continue;
+        depth = 0;
+        const std::size_t end = t.offset + t.length();
+        if (end - begin >= target) {
+            chunks.emplace_back(begin, end);
+            begin = end;
+        }
+    }
+    if (begin < source.size())
+        chunks.emplace_back(begin, source.size());
+    return chunks;
+}
+
+std::vector<NodeId> parse(std::string_view source, ASTContext& ctx, const unsigned threads) {
+    const auto strategy = llvm::hardware_concurrency(threads);
+    const auto workers = strategy.compute_thread_count();
+    std::vector<std::pair<std::size_t, std::size_t>> chunks;
+    if (workers > 1 && source.size() >= parallel_parse_min_bytes) {
+        try {
+            chunks = split_toplevel(source, source.size() / (workers * 4));
+        } catch (const std::invalid_argument&) {
+            // A lexing error: the serial parse below reports it, or an
+            // earlier parse error, exactly as it would have anyway.
+        }
+    }
+    if (chunks.size() < 2) {
+        auto lexer = Lexer(source);
+        auto stream = TokenStream(lexer);
+        return parse(stream, ctx);
+    }
+
+    // Each chunk is parsed into a context of its own, since ASTContext is
+    // not thread-safe, then appended to ctx in source order.
+    struct ParsedChunk {
+        ASTContext ctx;
+        std::vector<NodeId> roots;
+        std::exception_ptr error;
+    };
+    std::vector<ParsedChunk> parsed(chunks.size());
+    {
+        llvm::ThreadPool pool(strategy);
+        for (std::size_t i = 0; i < chunks.size(); i++) {
+            pool.async([&, i] {
+                auto& chunk = parsed[i];
+                try {
+                    auto lexer = Lexer(source.substr(0, chunks[i].second), chunks[i].first);
+                    auto stream = TokenStream(lexer);
+                    while (!stream.empty())
+                        chunk.roots.push_back(parse_toplevel(stream, chunk.ctx));
+                } catch (...) {
+                    chunk.error = std::current_exception();
+                }
+            });
+        }
+        pool.wait();
+    }
+
+    std::vector<NodeId> ast;
+    for (auto& chunk : parsed) {
+        if (chunk.error)
+            std::rethrow_exception(chunk.error);
+        const auto base = ctx.append(chunk.ctx);
+        for (const auto root : chunk.roots)
+            ast.push_back(root + base);
+        chunk.ctx.reset();
     }
     return ast;
 }
 
+TokenChannel::TokenChannel(const std::string_view source, const std::size_t capacity)
+    : source(source), queue(capacity),
+      eof{TokenView::make(tok_eof, static_cast<std::uint32_t>(source.size()), 0), {}, OperatorKind::none} {}
+
+void TokenChannel::produce() {
+    std::vector<LexedToken> pending;
+    try {
+        auto lexer = Lexer(source);
+        pending.reserve(batch_size);
+        for (bool done = false; !done;) {
+            const auto t = lexer.next();
+            pending.push_back({t, lexer.literal(), t.kind() == tok_operator ? lexer.op() : OperatorKind::none});
+            done = t.kind() == tok_eof;
+            if (pending.size() == batch_size || done) {
+                if (!queue.push(std::move(pending)))
+                    return;
+                pending = {};
+                pending.reserve(batch_size);
+            }
+        }
+        queue.close();
+    } catch (...) {
+        // Hand over what was scanned before the error, then the error.
+        if (!pending.empty())
+            queue.push(std::move(pending));
+        queue.close(std::current_exception());
+    }
+}
+
+const LexedToken& TokenChannel::next() {
+    while (cursor == batch.size()) {
+        auto received = queue.pop();
+        if (!received)
+            return eof;
+        batch = std::move(*received);
+        cursor = 0;
+    }
+    return batch[cursor++];
+}
+
+SourceLocation TokenChannel::locate(const std::uint32_t offset) const {
+    if (!lines)
+        lines = std::make_unique<LineTable>(source);
+    return lines->locate(offset);
+}
+
+void parse_pipelined(const std::string_view source, StatementQueue& out) {
+    TokenChannel channel(source);
+    std::thread lexer([&] { channel.produce(); });
+    try {
+        auto tokens = TokenStream(channel);
+        while (true) {
+            auto statement = std::make_unique<ParsedStatement>();
+            statement->root = parse_next_toplevel(tokens, statement->ctx);
+            if (statement->root == no_node || !out.push(std::move(statement)))
+                break;
+        }
+        out.close();
+    } catch (...) {
+        out.close(std::current_exception());
+    }
+    channel.cancel();
+    lexer.join();
+}
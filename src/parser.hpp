@@ -5,18 +5,183 @@
 #ifndef PARSER_HPP
 #define PARSER_HPP
 
+#include <memory>
+
 #include "ast.hpp"
+#include "bounded_queue.hpp"
 #include "lex.hpp"
 
-std::vector<std::unique_ptr<AST>> parse(std::vector<TokenPair>& tokens);
-
 class ParsingException : public std::exception {
     std::string message;
 public:
     explicit ParsingException(const std::string& msg) : message(msg) {}
+    ParsingException(const std::string& msg, const SourceLocation loc)
+        : message(std::to_string(loc.line) + ":" + std::to_string(loc.column) + ": " + msg) {}
     const char* what () const noexcept override {
         return message.c_str();
     }
 };
 
+/// LexedToken - A token together with what the lexer worked out about it.
+struct LexedToken {
+    TokenView token;
+    NumberValue value;
+    OperatorKind op;
+};
+
+/// TokenChannel - Carries the tokens of a source from a lexer running on one
+/// thread to a TokenStream reading on another. Tokens travel in batches so
+/// the threads synchronize once per batch rather than once per token, and
+/// the bounded queue keeps the lexer at most `capacity` batches ahead.
+class TokenChannel {
+    std::string_view source;
+    BoundedQueue<std::vector<LexedToken>> queue;
+    std::vector<LexedToken> batch;
+    std::size_t cursor = 0;
+    LexedToken eof;
+    mutable std::unique_ptr<LineTable> lines;
+public:
+    static constexpr std::size_t batch_size = 1024;
+
+    explicit TokenChannel(std::string_view source, std::size_t capacity = 16);
+
+    /// Lexer side: scans the whole source into the channel, ending with
+    /// tok_eof. A lexing error reaches the reader after the tokens before it.
+    /// Returns early once the reader has called cancel().
+    void produce();
+
+    /// Reader side: the next token, tok_eof repeatedly at end of input.
+    const LexedToken& next();
+
+    /// Reader side: stops the lexer, e.g. after a parse error.
+    void cancel() { queue.close(); }
+
+    std::string_view text(const TokenView& t) const { return token_text(source, t); }
+    SourceLocation locate(std::uint32_t offset) const;
+};
+
+/// TokenStream - Parser-side cursor that pulls tokens from a Lexer on demand.
+/// The grammar never needs more than two tokens of lookahead (e.g. telling
+/// `x = ...` apart from a call `x ...`), so only those are buffered and no
+/// token array is ever built. Past the end of input every token is tok_eof.
+/// Tokens come either straight from a Lexer or from a TokenChannel fed by a
+/// lexer on another thread.
+class TokenStream {
+    static constexpr std::size_t max_lookahead = 2;
+
+    Lexer* lexer = nullptr;
+    TokenChannel* channel = nullptr;
+    TokenView ahead[max_lookahead] = {};
+    NumberValue values[max_lookahead] = {};
+    OperatorKind ops[max_lookahead] = {};
+    std::size_t head = 0;
+    std::size_t count = 0;
+
+    void fill(const std::size_t n) {
+        while (count <= n) {
+            const auto slot = (head + count) % max_lookahead;
+            if (channel) {
+                const auto& t = channel->next();
+                ahead[slot] = t.token;
+                values[slot] = t.value;
+                ops[slot] = t.op;
+            } else {
+                ahead[slot] = lexer->next();
+                values[slot] = lexer->literal();
+                ops[slot] = ahead[slot].kind() == tok_operator ? lexer->op() : OperatorKind::none;
+            }
+            count++;
+        }
+    }
+public:
+    explicit TokenStream(Lexer& lexer) : lexer(&lexer) {}
+    explicit TokenStream(TokenChannel& channel) : channel(&channel) {}
+
+    const TokenView& peek(const std::size_t n = 0) {
+        if (n >= max_lookahead)
+            throw std::logic_error("TokenStream lookahead exceeded");
+        fill(n);
+        return ahead[(head + n) % max_lookahead];
+    }
+
+    /// Spelling of the token n positions ahead, as a view into the source.
+    std::string_view text(const std::size_t n = 0) {
+        return spelling(peek(n));
+    }
+
+    /// Converted value of the number literal n positions ahead.
+    const NumberValue& literal(const std::size_t n = 0) {
+        peek(n);
+        return values[(head + n) % max_lookahead];
+    }
+
+    /// Operator of the tok_operator n positions ahead.
+    OperatorKind op(const std::size_t n = 0) {
+        peek(n);
+        return ops[(head + n) % max_lookahead];
+    }
+
+    std::string_view spelling(const TokenView& t) const {
+        return channel ? channel->text(t) : lexer->text(t);
+    }
+
+    /// Line and column of the token n positions ahead, for diagnostics.
+    SourceLocation location(const std::size_t n = 0) {
+        const auto offset = peek(n).offset;
+        return channel ? channel->locate(offset) : lexer->locate(offset);
+    }
+
+    TokenView advance() {
+        const auto t = peek();
+        head = (head + 1) % max_lookahead;
+        count--;
+        return t;
+    }
+
+    /// Consumes the next token if it is of the given kind, throws otherwise.
+    TokenView expect(const Token kind, const std::string& message) {
+        if (peek().kind() != kind)
+            throw ParsingException(message + ", got: " + std::string(text()), location());
+        return advance();
+    }
+
+    bool empty() { return peek().kind() == tok_eof; }
+};
+
+/// Sources smaller than this are always parsed on the calling thread.
+constexpr std::size_t parallel_parse_min_bytes = 64 * 1024;
+
+/// Parses the next top-level statement into `ctx` and returns its NodeId,
+/// or no_node at end of input. A caller that is done with each statement
+/// before asking for the next can reset() `ctx` in between, so memory
+/// follows the largest statement rather than the whole source.
+NodeId parse_next_toplevel(TokenStream& tokens, ASTContext& ctx);
+
+/// Parses every top-level statement into `ctx` and returns their NodeIds in
+/// source order.
+std::vector<NodeId> parse(TokenStream& tokens, ASTContext& ctx);
+
+/// As above, but a large source is split at top-level statement boundaries
+/// and the pieces are parsed on up to `threads` threads (0: one per hardware
+/// thread), then merged into `ctx` in source order.
+std::vector<NodeId> parse(std::string_view source, ASTContext& ctx, unsigned threads = 0);
+
+/// ParsedStatement - One top-level statement in a context of its own, so it
+/// can be handed to another thread and freed as soon as it has been used.
+struct ParsedStatement {
+    ASTContext ctx;
+    NodeId root;
+};
+
+typedef BoundedQueue<std::unique_ptr<ParsedStatement>> StatementQueue;
+
+/// Statements a pipelined parse may get ahead of the stage consuming them.
+constexpr std::size_t pipeline_depth = 64;
+
+/// Parses `source` on the calling thread, with the lexer running ahead on a
+/// second one, and pushes each top-level statement into `out` as soon as it
+/// is complete. Closes `out` at the end of input, or with the error that
+/// stopped parsing; stops early if the consumer closes `out` first.
+void parse_pipelined(std::string_view source, StatementQueue& out);
+
 #endif //PARSER_HPP
@@ -21,10 +21,9 @@ int print_banner() {
     return 0;
 }
 
-int repl() {
+int repl(Compiler& c) {
     print_banner();
     char* buf;
-    auto c = Compiler(true);
     bool expr_complete = false;
     const auto prompt = ">> ";
     auto incomplete_prompt = "   ";
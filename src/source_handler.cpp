@@ -0,0 +1,110 @@
+//
+// Created by jonathan on 10/17/26.
+//
+
+#include "source_handler.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+
+namespace {
+
+SourceException source_error(const std::string& name, const std::string& what) {
+    return SourceException(name + ": " + what);
+}
+
+SourceException errno_error(const std::string& name, const std::string& what) {
+    return source_error(name, what + ": " + std::strerror(errno));
+}
+
+// Owns a file descriptor for the duration of SourceBuffer::open; stdin is
+// borrowed and left open.
+class FileDescriptor {
+    int fd;
+    bool owned;
+public:
+    FileDescriptor(const int fd, const bool owned) : fd(fd), owned(owned) {}
+    ~FileDescriptor() {
+        if (owned && fd >= 0)
+            ::close(fd);
+    }
+    int get() const { return fd; }
+};
+
+} // namespace
+
+SourceBuffer SourceBuffer::open(const std::string& path) {
+    const bool is_stdin = path == "-";
+    auto buffer = SourceBuffer(is_stdin ? "<stdin>" : path);
+
+    const auto fd = FileDescriptor(is_stdin ? STDIN_FILENO : ::open(path.c_str(), O_RDONLY | O_CLOEXEC), !is_stdin);
+    if (fd.get() < 0)
+        throw errno_error(buffer.name, "cannot open source file");
+
+    struct stat st = {};
+    if (::fstat(fd.get(), &st) != 0)
+        throw errno_error(buffer.name, "cannot stat source file");
+    if (S_ISDIR(st.st_mode))
+        throw source_error(buffer.name, "is a directory");
+
+    if (S_ISREG(st.st_mode)) {
+        if (st.st_size == 0)
+            return buffer;
+
+        const auto size = static_cast<std::size_t>(st.st_size);
+        void* map = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd.get(), 0);
+        if (map != MAP_FAILED) {
+            ::madvise(map, size, MADV_SEQUENTIAL);
+            buffer.mapping = static_cast<const char*>(map);
+            buffer.mapped_size = size;
+            return buffer;
+        }
+        // Some filesystems can't be mapped; fall through and read instead.
+    }
+
+    char chunk[1 << 16];
+    while (true) {
+        const auto n = ::read(fd.get(), chunk, sizeof(chunk));
+        if (n == 0)
+            break;
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            throw errno_error(buffer.name, "cannot read source file");
+        }
+        buffer.contents.append(chunk, static_cast<std::size_t>(n));
+    }
+    return buffer;
+}
+
+SourceBuffer SourceBuffer::fromString(std::string name, std::string contents) {
+    auto buffer = SourceBuffer(std::move(name));
+    buffer.contents = std::move(contents);
+    return buffer;
+}
+
+SourceBuffer::SourceBuffer(SourceBuffer&& other) noexcept
+    : name(std::move(other.name)), mapping(std::exchange(other.mapping, nullptr)),
+      mapped_size(std::exchange(other.mapped_size, 0)), contents(std::move(other.contents)) {}
+
+SourceBuffer& SourceBuffer::operator=(SourceBuffer&& other) noexcept {
+    if (this != &other) {
+        if (mapping)
+            ::munmap(const_cast<char*>(mapping), mapped_size);
+        name = std::move(other.name);
+        mapping = std::exchange(other.mapping, nullptr);
+        mapped_size = std::exchange(other.mapped_size, 0);
+        contents = std::move(other.contents);
+    }
+    return *this;
+}
+
+SourceBuffer::~SourceBuffer() {
+    if (mapping)
+        ::munmap(const_cast<char*>(mapping), mapped_size);
+}
@@ -5,16 +5,47 @@
 #ifndef ELLIS_SOURCE_HANDLER_HPP
 #define ELLIS_SOURCE_HANDLER_HPP
 
-#include<iostream>
-#include<fstream>
-#include<sstream>
-#include<string>
-
-std::string read_file(std::string filename) {
-    std::ifstream t(filename);
-    std::stringstream buffer;
-    buffer << t.rdbuf();
-    return buffer.str();
-}
+#include <cstddef>
+#include <exception>
+#include <string>
+#include <string_view>
+
+class SourceException : public std::exception {
+    std::string message;
+public:
+    explicit SourceException(const std::string& msg) : message(msg) {}
+    const char* what () const noexcept override {
+        return message.c_str();
+    }
+};
+
+/// SourceBuffer - Read-only contents of one source file, which the lexer
+/// scans in place. Regular files are memory-mapped, so loading them copies
+/// nothing; pipes, terminals and other non-seekable inputs (including stdin,
+/// opened as "-") are read into an owned string instead. Failing to open or
+/// read the input throws a SourceException naming the file.
+class SourceBuffer {
+    std::string name;
+    const char* mapping = nullptr;
+    std::size_t mapped_size = 0;
+    std::string contents;
+
+    explicit SourceBuffer(std::string name) : name(std::move(name)) {}
+public:
+    static SourceBuffer open(const std::string& path);
+    static SourceBuffer fromString(std::string name, std::string contents);
+
+    SourceBuffer(SourceBuffer&& other) noexcept;
+    SourceBuffer& operator=(SourceBuffer&& other) noexcept;
+    SourceBuffer(const SourceBuffer&) = delete;
+    SourceBuffer& operator=(const SourceBuffer&) = delete;
+    ~SourceBuffer();
+
+    std::string_view view() const {
+        return mapping ? std::string_view(mapping, mapped_size) : std::string_view(contents);
+    }
+    const std::string& getName() const { return name; }
+    bool isMapped() const { return mapping != nullptr; }
+};
 
 #endif //ELLIS_SOURCE_HANDLER_HPP
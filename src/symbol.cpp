@@ -0,0 +1,47 @@
+//
+// Created by jonathan on 10/17/26.
+//
+
+#include "symbol.hpp"
+
+#include <limits>
+#include <mutex>
+#include <stdexcept>
+
+SymbolTable& SymbolTable::global() {
+    static SymbolTable table;
+    return table;
+}
+
+Symbol SymbolTable::intern(std::string_view name) {
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        const auto it = ids.find(name);
+        if (it != ids.end())
+            return it->second;
+    }
+
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    // Another thread may have added it between the two locks.
+    const auto it = ids.find(name);
+    if (it != ids.end())
+        return it->second;
+
+    if (names.size() >= std::numeric_limits<Symbol>::max())
+        throw std::length_error("Symbol table full");
+
+    const auto id = static_cast<Symbol>(names.size());
+    const auto& stored = names.emplace_back(name);
+    ids.emplace(stored, id);
+    return id;
+}
+
+const std::string& SymbolTable::name(const Symbol s) const {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return names[s];
+}
+
+std::size_t SymbolTable::size() const {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return names.size();
+}
@@ -0,0 +1,49 @@
+//
+// Created by jonathan on 10/17/26.
+//
+
+#ifndef ELLIS_SYMBOL_HPP
+#define ELLIS_SYMBOL_HPP
+
+#include <cstdint>
+#include <deque>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+/// Symbol - Interned identifier or operator spelling. Two names are equal
+/// exactly when their symbols are, so tables keyed by name can hash or index
+/// a 32-bit integer instead of comparing strings.
+typedef std::uint32_t Symbol;
+
+/// Marks a token or node that carries no symbol; never handed out by intern().
+constexpr Symbol no_symbol = UINT32_MAX;
+
+/// SymbolTable - Process-wide interner mapping spellings to dense Symbol ids,
+/// assigned in first-seen order starting at 0. Interned names live as long as
+/// the table, so references returned by name() stay valid.
+///
+/// Safe to use from several threads (e.g. parallel parsing): lookups share a
+/// reader lock and only a first-seen name takes the writer lock.
+class SymbolTable {
+    mutable std::shared_mutex mutex;
+    std::deque<std::string> names;
+    std::unordered_map<std::string_view, Symbol> ids;
+public:
+    static SymbolTable& global();
+
+    Symbol intern(std::string_view name);
+    const std::string& name(Symbol s) const;
+    std::size_t size() const;
+};
+
+inline Symbol intern(std::string_view name) {
+    return SymbolTable::global().intern(name);
+}
+
+inline const std::string& symbol_name(const Symbol s) {
+    return SymbolTable::global().name(s);
+}
+
+#endif //ELLIS_SYMBOL_HPP
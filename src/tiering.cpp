@@ -0,0 +1,206 @@
+//
+// Created by jonathan on 10/17/26.
+//
+
+#include "tiering.hpp"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/ExecutionEngine/Orc/CompileUtils.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include <chrono>
+#include <vector>
+
+using namespace llvm;
+using namespace llvm::orc;
+
+namespace {
+
+constexpr const char* tier_up_hook = "__ellis_tier_up";
+
+orc::JITTargetMachineBuilder at_level(JITTargetMachineBuilder target, const CodeGenOpt::Level level) {
+    target.setCodeGenOptLevel(level);
+    target.getOptions().EnableFastISel = level == CodeGenOpt::None;
+    return target;
+}
+
+std::string level_name(const OptimizationLevel& level) {
+    if (level.getSizeLevel() > 0)
+        return level.getSizeLevel() == 1 ? "s" : "z";
+    return std::to_string(level.getSpeedupLevel());
+}
+
+} // namespace
+
+TierManager::TierManager(ExecutionSession& ES, JITDylib& JD, MangleAndInterner& Mangle, ObjectLayer& ObjectLayer,
+                         JITTargetMachineBuilder Target, TieringOptions options)
+    : ES(ES), JD(JD), Mangle(Mangle), Target(Target),
+      BaselineCache(at_level(Target, CodeGenOpt::None), CodeGenOpt::None, "tier0"),
+      OptimizedCache(at_level(Target, codegen_opt_level(options.level)), codegen_opt_level(options.level), "tier1"),
+      BaselineLayer(ES, ObjectLayer,
+                    std::make_unique<ConcurrentIRCompiler>(at_level(Target, CodeGenOpt::None), &BaselineCache)),
+      OptimizedLayer(ES, ObjectLayer,
+                     std::make_unique<ConcurrentIRCompiler>(at_level(Target, codegen_opt_level(options.level)),
+                                                            &OptimizedCache)),
+      Stubs(createLocalIndirectStubsManagerBuilder(Target.getTargetTriple())()), options(options),
+      optimizer(options.level, Target), pool(hardware_concurrency(1)) {
+    cantFail(JD.define(absoluteSymbols(
+            {{Mangle(tier_up_hook), JITEvaluatedSymbol(pointerToJITTargetAddress(&TierManager::tierUp),
+                                                       JITSymbolFlags::Exported | JITSymbolFlags::Callable)}})));
+}
+
+TierManager::~TierManager() {
+    pool.wait();
+}
+
+Error TierManager::enableObjectCache(const ObjectCacheOptions& options) {
+    if (auto err = BaselineCache.open(options))
+        return err;
+    return OptimizedCache.open(options);
+}
+
+void TierManager::tierUp(void* counter) {
+    auto& tier = *static_cast<TierCounter*>(counter)->state;
+    tier.manager->pool.async([&tier] { tier.manager->promote(tier); });
+}
+
+void TierManager::instrument(Function& F, const StringRef name) const {
+    // Count after the allocas, so that they stay in the entry block.
+    auto split = F.getEntryBlock().getFirstInsertionPt();
+    while (isa<AllocaInst>(*split))
+        ++split;
+
+    IRBuilder<> B(&*split);
+    auto* type = StructType::get(B.getInt64Ty(), B.getInt8PtrTy());
+    auto* counter = new GlobalVariable(*F.getParent(), type, false, GlobalValue::ExternalLinkage,
+                                       Constant::getNullValue(type), name + "$calls");
+    auto* calls = B.CreateAtomicRMW(AtomicRMWInst::Add, B.CreateStructGEP(type, counter, 0), B.getInt64(1),
+                                    MaybeAlign(8), AtomicOrdering::Monotonic);
+    auto* hot = B.CreateICmpEQ(calls, B.getInt64(options.threshold - 1), "hot");
+
+    B.SetInsertPoint(SplitBlockAndInsertIfThen(hot, &*split, false));
+    auto hook = F.getParent()->getOrInsertFunction(
+            tier_up_hook, FunctionType::get(B.getVoidTy(), {B.getInt8PtrTy()}, false));
+    B.CreateCall(hook, {B.CreateBitCast(counter, B.getInt8PtrTy())});
+}
+
+Error TierManager::add(ResourceTrackerSP RT, ThreadSafeModule TSM) {
+    struct Baseline {
+        std::string name;
+        SymbolStringPtr body;
+        SymbolStringPtr counter;
+        TierState* state;
+    };
+    SymbolMap stubs;
+    std::vector<Baseline> bodies;
+    auto err = TSM.withModuleDo([&](Module& M) -> Error {
+        std::vector<Function*> functions;
+        for (auto& F : M)
+            if (!F.isDeclaration() && !F.getName().startswith("__"))
+                functions.push_back(&F);
+
+        // Keep the module as it is before any function is renamed or
+        // instrumented, once for all of its functions, so that the hot ones
+        // extracted from it call the others through the stubs.
+        auto source = std::make_shared<std::string>();
+        if (!functions.empty()) {
+            raw_string_ostream stream(*source);
+            WriteBitcodeToFile(M, stream);
+            stream.flush();
+        }
+        std::vector<TierState*> tiers;
+        {
+            std::lock_guard lock(mutex);
+            for (auto* F : functions) {
+                auto& tier = states.emplace_back();
+                tier.manager = this;
+                tier.name = F->getName().str();
+                tier.source = source;
+                tiers.push_back(&tier);
+            }
+        }
+
+        for (std::size_t i = 0; i < functions.size(); i++) {
+            auto* F = functions[i];
+            const auto name = F->getName().str();
+            F->setName(name + "$tier0");
+            F->replaceAllUsesWith(Function::Create(F->getFunctionType(), Function::ExternalLinkage, name, M));
+            instrument(*F, name);
+
+            if (auto err = Stubs->createStub(name, 0, JITSymbolFlags::Exported | JITSymbolFlags::Callable))
+                return err;
+            stubs[Mangle(name)] = Stubs->findStub(name, false);
+            bodies.push_back({name, Mangle(name + "$tier0"), Mangle(name + "$calls"), tiers[i]});
+        }
+        return Error::success();
+    });
+    if (err)
+        return err;
+    if (auto err = BaselineLayer.add(RT, std::move(TSM)))
+        return err;
+    if (bodies.empty())
+        return Error::success();
+    if (auto err = JD.define(absoluteSymbols(std::move(stubs)), RT))
+        return err;
+
+    // Compile the baseline now, so that no stub is ever called unset, and
+    // tie each counter to its state before the function can reach the hook.
+    SymbolLookupSet lookup;
+    for (const auto& baseline : bodies) {
+        lookup.add(baseline.body);
+        lookup.add(baseline.counter);
+    }
+    auto compiled = ES.lookup(makeJITDylibSearchOrder(&JD), std::move(lookup));
+    if (!compiled)
+        return compiled.takeError();
+    for (const auto& baseline : bodies) {
+        jitTargetAddressToPointer<TierCounter*>((*compiled)[baseline.counter].getAddress())->state = baseline.state;
+        if (auto err = Stubs->updatePointer(baseline.name, (*compiled)[baseline.body].getAddress()))
+            return err;
+    }
+    return Error::success();
+}
+
+void TierManager::promote(TierState& state) {
+    const auto start = std::chrono::steady_clock::now();
+    auto err = [&]() -> Error {
+        auto context = std::make_unique<LLVMContext>();
+        auto source = parseBitcodeFile(MemoryBufferRef(*state.source, state.name), *context);
+        if (!source)
+            return source.takeError();
+        // Only the hot function is defined; the rest of its module is declared.
+        ValueToValueMapTy VMap;
+        auto module = CloneModule(**source, VMap, [&](const GlobalValue* GV) { return GV->getName() == state.name; });
+        source->reset();
+        module->getFunction(state.name)->setName(state.name + "$tier1");
+        try {
+            optimizer.run(*module);
+        } catch (const std::exception& e) {
+            return createStringError(inconvertibleErrorCode(), e.what());
+        }
+        if (auto err = OptimizedLayer.add(JD, ThreadSafeModule(std::move(module), std::move(context))))
+            return err;
+        auto body = ES.lookup({&JD}, Mangle(state.name + "$tier1"));
+        if (!body)
+            return body.takeError();
+        return Stubs->updatePointer(state.name, body->getAddress());
+    }();
+    // A function tiers up once; the module is freed with its last function.
+    state.source.reset();
+    if (err) {
+        ES.reportError(std::move(err));
+        return;
+    }
+    promoted++;
+
+    if (options.log) {
+        const std::chrono::duration<double, std::milli> took = std::chrono::steady_clock::now() - start;
+        std::lock_guard lock(mutex);
+        *options.log << "tier-up: " << state.name << " after " << options.threshold << " calls, recompiled at -O"
+                     << level_name(options.level) << " in " << format("%.1f", took.count()) << " ms\n";
+        options.log->flush();
+    }
+}
@@ -0,0 +1,125 @@
+//
+// Created by jonathan on 10/17/26.
+//
+
+#ifndef ELLIS_TIERING_HPP
+#define ELLIS_TIERING_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "llvm/ExecutionEngine/Orc/Core.h"
+#include "llvm/ExecutionEngine/Orc/IRCompileLayer.h"
+#include "llvm/ExecutionEngine/Orc/IndirectionUtils.h"
+#include "llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h"
+#include "llvm/ExecutionEngine/Orc/Layer.h"
+#include "llvm/ExecutionEngine/Orc/Mangling.h"
+#include "llvm/ExecutionEngine/Orc/ThreadSafeModule.h"
+#include "llvm/Passes/OptimizationLevel.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "object_cache.hpp"
+#include "optimizer.hpp"
+
+/// TieringOptions - When and how a tiered EllisJIT recompiles hot functions.
+struct TieringOptions {
+    /// Calls after which a function is recompiled with full optimization.
+    unsigned threshold = 1000;
+    /// Level hot functions are recompiled at.
+    llvm::OptimizationLevel level = llvm::OptimizationLevel::O2;
+    /// Where tier-up events are logged; nullptr for nowhere.
+    llvm::raw_ostream* log = &llvm::errs();
+};
+
+/// TierManager - Two-tier compilation for EllisJIT. Every function is first
+/// compiled unoptimized with FastISel, under the name `f$tier0`, and the
+/// symbol `f` itself is an indirect stub pointing at that body, so every
+/// call, including calls from other modules, goes through the stub.
+///
+/// The baseline body counts its calls in `f$calls`, a global of its own
+/// module. When the count reaches the threshold it asks for a tier-up: the
+/// function is extracted from a copy of its module taken before it was
+/// instrumented, optimized and compiled as `f$tier1` on a background thread,
+/// and the stub is then repointed at it. Calls already running in the
+/// baseline body finish there; later calls run optimized code.
+///
+/// The counters, stubs and hook are all reached through relocations, never
+/// through addresses of this run baked into the IR, so the objects of both
+/// tiers can be kept in a DiskObjectCache and loaded by later runs.
+///
+/// Functions whose names start with "__" (the REPL's __anon_expr) are entry
+/// points that run once; they are compiled at the baseline and not stubbed.
+class TierManager {
+    /// Per-function state, at a stable address the function's counter holds.
+    struct TierState {
+        TierManager* manager;
+        std::string name;
+        /// Bitcode of the module the function was added in, as it was before
+        /// renaming and instrumentation; shared by the module's functions and
+        /// released once this one has tiered up.
+        std::shared_ptr<const std::string> source;
+    };
+
+    /// Layout of a baseline function's `f$calls` global. `state` is filled
+    /// in once the module is linked, before the function can be called.
+    struct TierCounter {
+        std::uint64_t calls;
+        TierState* state;
+    };
+
+    llvm::orc::ExecutionSession& ES;
+    llvm::orc::JITDylib& JD;
+    llvm::orc::MangleAndInterner& Mangle;
+    llvm::orc::JITTargetMachineBuilder Target;
+    DiskObjectCache BaselineCache;
+    DiskObjectCache OptimizedCache;
+    llvm::orc::IRCompileLayer BaselineLayer;
+    llvm::orc::IRCompileLayer OptimizedLayer;
+    std::unique_ptr<llvm::orc::IndirectStubsManager> Stubs;
+    TieringOptions options;
+    Optimizer optimizer; // of hot functions
+
+    std::mutex mutex;
+    std::deque<TierState> states;
+    std::atomic<unsigned> promoted{0};
+    llvm::ThreadPool pool;
+
+    static void tierUp(void* counter);
+    void promote(TierState& state);
+    void instrument(llvm::Function& F, llvm::StringRef name) const;
+public:
+    /// Compiles into `JD` through `ObjectLayer`, for the target `Target`
+    /// describes. `options.threshold` must not be 0.
+    TierManager(llvm::orc::ExecutionSession& ES, llvm::orc::JITDylib& JD, llvm::orc::MangleAndInterner& Mangle,
+                llvm::orc::ObjectLayer& ObjectLayer, llvm::orc::JITTargetMachineBuilder Target,
+                TieringOptions options);
+    ~TierManager();
+
+    /// Compiles the module at the baseline tier and points a stub named after
+    /// each of its functions at the result.
+    llvm::Error add(llvm::orc::ResourceTrackerSP RT, llvm::orc::ThreadSafeModule TSM);
+
+    /// Keeps the machine code of both tiers in the on-disk cache `options`
+    /// names, keyed by tier. Must be called before anything is added.
+    llvm::Error enableObjectCache(const ObjectCacheOptions& options);
+
+    /// Optimizes hot functions; its timings and remarks can be shared with
+    /// another Optimizer through reportTo().
+    Optimizer& getOptimizer() { return optimizer; }
+
+    const DiskObjectCache& getBaselineCache() const { return BaselineCache; }
+    const DiskObjectCache& getOptimizedCache() const { return OptimizedCache; }
+
+    /// Waits for the tier-ups already requested to finish.
+    void wait() { pool.wait(); }
+
+    /// Number of functions recompiled so far.
+    unsigned promotions() const { return promoted; }
+};
+
+#endif //ELLIS_TIERING_HPP